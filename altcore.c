@@ -0,0 +1,71 @@
+#include <stdint.h>
+
+/*
+The alternative engine for --lockstep.  By default it's a private copy of
+fake65c02.h, which is only useful to check the lockstep machinery itself.
+To check a new core, give it the same interface as fake65c02.h
+(step6502, read6502, write6502 and the register globals) and build with
+something like:
+
+    make CCFLAGS='-Wall -fno-common -DLOCKSTEP_CORE=\"fast65c02.h\"'
+
+corecopy.h renames the core's global functions so it can link with the reference.
+*/
+#ifndef LOCKSTEP_CORE
+#define LOCKSTEP_CORE "fake65c02.h"
+#endif
+
+#define CORE_FILE LOCKSTEP_CORE
+#define CORE_COPY(name) alt_##name
+#include "corecopy.h"
+
+#include "altcore.h"
+#include "magicio.h"
+
+uint8_t alt_memory[0x10000];
+
+int alt_nwrites = 0;
+uint16_t alt_waddrs[ALT_MAX_WRITES];
+uint8_t alt_wvals[ALT_MAX_WRITES];
+
+const uint8_t *alt_io_memory = NULL;
+
+
+uint8 read6502(ushort addr) {
+    if (alt_io_memory && (ushort)(addr - io_addr) < IO_SIZE) return alt_io_memory[(ushort)(addr - io_addr)];
+    return alt_memory[addr];
+}
+
+void write6502(ushort addr, uint8 val) {
+    if (alt_nwrites < ALT_MAX_WRITES) {
+        alt_waddrs[alt_nwrites] = addr;
+        alt_wvals[alt_nwrites] = val;
+    }
+    alt_nwrites++;
+    alt_memory[addr] = val;
+}
+
+void alt_get(AltState *s) {
+    s->pc = pc;
+    s->a = a;
+    s->x = x;
+    s->y = y;
+    s->sp = sp;
+    s->status = status;
+    s->waiting = waiting6502;
+}
+
+void alt_set(const AltState *s) {
+    pc = s->pc;
+    a = s->a;
+    x = s->x;
+    y = s->y;
+    sp = s->sp;
+    status = s->status;
+    waiting6502 = s->waiting;
+}
+
+uint32_t alt_step() {
+    alt_nwrites = 0;
+    return step6502();
+}
@@ -0,0 +1,25 @@
+/*
+A second, independent copy of a 6502 core with its own memory,
+which --lockstep runs alongside the reference core in fake65c02.h.
+*/
+
+typedef struct AltState {
+    uint16_t pc;
+    uint8_t a, x, y, sp, status, waiting;
+} AltState;
+
+#define ALT_MAX_WRITES 8
+
+extern uint8_t alt_memory[0x10000];
+
+/* the writes made by the last alt_step, in order */
+extern int alt_nwrites;
+extern uint16_t alt_waddrs[ALT_MAX_WRITES];
+extern uint8_t alt_wvals[ALT_MAX_WRITES];
+
+/* reads in the magic IO block come from this IO_SIZE copy, see lockstep.c */
+extern const uint8_t *alt_io_memory;
+
+void alt_get(AltState *s);
+void alt_set(const AltState *s);
+uint32_t alt_step();
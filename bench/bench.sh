@@ -0,0 +1,42 @@
+#!/bin/sh
+# Run the benchmark workloads with heatmap counting off and on, reporting
+# the best of $REPEAT runs as host nanoseconds per instruction and emulated MHz.
+# Usage: bench/bench.sh [path/to/c65], normally via `make bench`
+
+C65=${1:-./c65}
+REPEAT=${REPEAT:-3}
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/c65bench.$$
+
+trap 'rm -f $TMP.json' EXIT
+
+run() {
+    name=$1
+    shift
+    for heat in off on; do
+        flag=
+        [ $heat = off ] && flag=--no-heat
+        best=
+        i=0
+        while [ $i -lt $REPEAT ]; do
+            "$C65" -q $flag --stats $TMP.json "$@" < /dev/null > /dev/null || exit 1
+            line=$(awk -F'[:,]' '
+                /"instructions"/ { n = $2 }
+                /"ticks"/ { t = $2 }
+                /"wall_secs"/ { s = $2 }
+                END { printf "%d %d %.9f", n, t, s }' $TMP.json)
+            secs=${line##* }
+            if [ -z "$best" ] || awk "BEGIN { exit !($secs < ${best##* }) }"; then best=$line; fi
+            i=$((i+1))
+        done
+        echo "$name $heat $best" | awk '{
+            printf "%-10s %-4s %12d %12d %9.2f %8.2f\n", $1, $2, $3, $4, $5 * 1e9 / $3, $4 / $5 / 1e6 }'
+    done
+}
+
+echo "# c65 benchmark, best of $REPEAT runs"
+printf "%-10s %-4s %12s %12s %9s %8s\n" workload heat instructions ticks ns/inst MHz
+run wozmon -r "$DIR/../tests/wozmon.rom" -i "$DIR/wozmon.in"
+for w in opcodes decimal memcpy putc; do
+    run $w -r "$DIR/$w.rom" -a 0x1000 -s 0x1000
+done
@@ -0,0 +1,226 @@
+/*
+Generate the synthetic workloads for `make bench`.  Each is a small program
+assembled at $1000 which loops a fixed number of times and then hits BRK,
+so run it like:
+
+    ./c65 -r decimal.rom -a 0x1000 -s 0x1000
+
+Usage: benchrom <opcodes|decimal|memcpy|putc> file.rom
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ORG 0x1000
+
+static uint8_t rom[0x1000];
+static int here = 0;
+
+static void emit(int b) {
+    rom[here++] = (uint8_t)b;
+}
+
+static void op2(int op, int b) { emit(op); emit(b); }
+static void op3(int op, int w) { emit(op); emit(w & 0xff); emit(w >> 8); }
+
+static void branch(int op, int target) {
+    /* branch back to target, which must be in range */
+    int offset = target - (here + 2);
+
+    if (offset < -128) {
+        fprintf(stderr, "benchrom: branch out of range\n");
+        exit(1);
+    }
+    op2(op, offset & 0xff);
+}
+
+static void loop(int counter, int target) {
+    /* decrement the 16 bit counter and jump back to target until it reaches zero */
+    op2(0xc6, counter);     /* dec counter */
+    op2(0xd0, 4);           /* bne jmp */
+    op2(0xc6, counter+1);   /* dec counter+1 */
+    op2(0xf0, 3);           /* beq past the jmp */
+    op3(0x4c, ORG + target);
+}
+
+static void count(int counter, int n) {
+    /* set counter so loop runs n times */
+    op2(0xa9, n & 0xff);                    /* lda #<n */
+    op2(0x85, counter);                     /* sta counter */
+    op2(0xa9, (n >> 8) + (n & 0xff ? 1 : 0));
+    op2(0x85, counter+1);                   /* sta counter+1 */
+}
+
+/*
+Some 65c02 opcodes can't run in a straight line, since they jump elsewhere
+or stop the processor.  Branches are included with a zero offset so they
+continue with the next instruction whether or not they're taken.
+*/
+static const uint8_t _skip[] = { 0x00, 0x20, 0x40, 0x4c, 0x60, 0x6c, 0x7c, 0xcb, 0xdb };
+
+/*
+The addressing mode for each opcode, following addrtable in fake65c02.h:
+1 implied or accumulator, i immediate, z zero page incl (zp) and (zp),y,
+x zp,x or (zp,x), y zp,y, r relative incl zp relative, a absolute,
+X abs,x and Y abs,y
+*/
+static const char *_modes =
+    "1xi1zzzz1i11aaar" "rzz1zxxz1Y11aXXr"
+    "axi1zzzz1i11aaar" "rzz1xxxz1Y11XXXr"
+    "1xi1zzzz1i11aaar" "rzz1xxxz1Y11aXXr"
+    "1xi1zzzz1i11aaar" "rzz1xxxz1Y11aXXr"
+    "rxi1zzzz1i11aaar" "rzz1xxyz1Y11aXXr"
+    "ixi1zzzz1i11aaar" "rzz1xxyz1Y11XXYr"
+    "ixi1zzzz1i11aaar" "rzz1xxxz1Y11aXXr"
+    "ixi1zzzz1i11aaar" "rzz1xxxz1Y11aXXr";
+
+static void opcodes() {
+    /*
+    execute every opcode in turn.  all of zero page points at $0303, and
+    operands use zero page $80 or absolute $0300, so that memory writes
+    stay clear of the code and the loop counter at $10
+    */
+    int op, start;
+
+    op2(0xa2, 0);           /* ldx #0 */
+    op2(0xa9, 0x03);        /* lda #3 */
+    start = here;
+    op2(0x95, 0);           /* sta 0,x */
+    emit(0xe8);             /* inx */
+    branch(0xd0, start);    /* bne */
+    count(0x10, 0x8000);
+
+    start = here;
+    for (op=0; op<256; op++) {
+        if (memchr(_skip, op, sizeof(_skip))) continue;
+        switch (_modes[op]) {
+            case 'x':   /* zp,x and (zp,x) must stay on the zero page pointer */
+                op2(0xa2, 0);
+                break;
+            case 'y':   /* zp,y */
+                op2(0xa0, 0);
+                break;
+        }
+        switch (_modes[op]) {
+            case '1':
+                emit(op);
+                break;
+            case 'i':
+                op2(op, 0x01);
+                break;
+            case 'z': case 'x': case 'y':
+                op2(op, 0x80);
+                break;
+            case 'r':   /* branch to the next instruction, incl bbr/bbs */
+                if ((op & 0xf) == 0xf) op3(op, 0x0080);
+                else op2(op, 0);
+                break;
+            default:    /* absolute, incl abs,x and abs,y within page 3 */
+                op3(op, 0x0300);
+                break;
+        }
+    }
+    loop(0x10, start);
+    emit(0x00);             /* brk */
+}
+
+static void decimal() {
+    /* bcd arithmetic on three running totals */
+    int start, inner;
+
+    emit(0xf8);             /* sed */
+    count(0x10, 2400);
+    start = here;
+    op2(0xa2, 0);           /* ldx #0 */
+    inner = here;
+    emit(0x18);             /* clc */
+    op2(0xa5, 0x20);        /* lda $20 */
+    op2(0x69, 0x37);        /* adc #$37 */
+    op2(0x85, 0x20);        /* sta $20 */
+    op2(0xa5, 0x21);        /* lda $21 */
+    op2(0x69, 0x00);        /* adc #0 */
+    op2(0x85, 0x21);        /* sta $21 */
+    emit(0x38);             /* sec */
+    op2(0xa5, 0x22);        /* lda $22 */
+    op2(0xe9, 0x19);        /* sbc #$19 */
+    op2(0x85, 0x22);        /* sta $22 */
+    emit(0xca);             /* dex */
+    branch(0xd0, inner);    /* bne */
+    loop(0x10, start);
+    emit(0x00);
+}
+
+static void memcpy_() {
+    /* copy $2000-$3fff to $4000-$5fff a page at a time */
+    int start, page, byte;
+
+    count(0x10, 240);
+    start = here;
+    op2(0xa9, 0);           /* lda #0 */
+    op2(0x85, 0x00);        /* sta src */
+    op2(0x85, 0x02);        /* sta dst */
+    op2(0xa9, 0x20);        /* lda #>$2000 */
+    op2(0x85, 0x01);
+    op2(0xa9, 0x40);        /* lda #>$4000 */
+    op2(0x85, 0x03);
+    op2(0xa2, 0x20);        /* ldx #32 pages */
+    page = here;
+    op2(0xa0, 0);           /* ldy #0 */
+    byte = here;
+    op2(0xb1, 0x00);        /* lda (src),y */
+    op2(0x91, 0x02);        /* sta (dst),y */
+    emit(0xc8);             /* iny */
+    branch(0xd0, byte);     /* bne */
+    op2(0xe6, 0x01);        /* inc src+1 */
+    op2(0xe6, 0x03);        /* inc dst+1 */
+    emit(0xca);             /* dex */
+    branch(0xd0, page);     /* bne */
+    loop(0x10, start);
+    emit(0x00);
+}
+
+static void putc_() {
+    /* write lines of 64 printable characters to the magic putc port */
+    int start, ch;
+
+    count(0x10, 4096);
+    start = here;
+    op2(0xa2, 0);           /* ldx #0 */
+    ch = here;
+    emit(0x8a);             /* txa */
+    op2(0x29, 0x3f);        /* and #$3f */
+    op2(0x09, 0x40);        /* ora #$40 */
+    op3(0x8d, 0xf001);      /* sta putc */
+    emit(0xe8);             /* inx */
+    op2(0xe0, 64);          /* cpx #64 */
+    branch(0xd0, ch);       /* bne */
+    op2(0xa9, 0x0a);        /* lda #10 */
+    op3(0x8d, 0xf001);      /* sta putc */
+    loop(0x10, start);
+    emit(0x00);
+}
+
+int main(int argc, char *argv[]) {
+    FILE *fout;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: benchrom <opcodes|decimal|memcpy|putc> file.rom\n");
+        return 2;
+    }
+    if (!strcmp(argv[1], "opcodes")) opcodes();
+    else if (!strcmp(argv[1], "decimal")) decimal();
+    else if (!strcmp(argv[1], "memcpy")) memcpy_();
+    else if (!strcmp(argv[1], "putc")) putc_();
+    else {
+        fprintf(stderr, "benchrom: unknown workload %s\n", argv[1]);
+        return 2;
+    }
+    fout = fopen(argv[2], "wb");
+    if (!fout || fwrite(rom, 1, here, fout) != here) {
+        fprintf(stderr, "Error writing %s\n", argv[2]);
+        return 1;
+    }
+    fclose(fout);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+Time every opcode in fake65c02.h, both through the real c65 bus
+(read6502 and write6502 with breakpoints, heatmap and magic IO)
+and through a stub bus, to show which handlers cost the most.
+
+Each measurement resets the registers and steps one instruction at $0400,
+so even jumps and BRK can be timed in isolation.  Operands point at zero
+page $80 or absolute $0300, and vectors point back to $0400.  Extra rows
+time adc and sbc in decimal mode, and indexed modes and taken branches
+which cross a page boundary.
+
+Usage: opbench [iterations], normally via `make opbench`
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define FAKE6502_NOT_STATIC 1
+#define FAKE6502_INCLUDE 1
+#include "fake65c02.h"
+
+#include "opbench.h"
+#include "c65.h"
+#include "magicio.h"
+
+#define VAR_BASE 0
+#define VAR_BCD 1
+#define VAR_CROSS 2
+
+typedef struct Result {
+    uint8_t op, variant;
+    uint32_t ticks;
+    double ns[2];
+} Result;
+
+static const char *_varnames[] = { "", "decimal", "cross" };
+
+static void _real_reset(uint16_t pc_, uint8_t x_, uint8_t y_, uint8_t status_) {
+    pc = pc_;
+    a = 0x55;
+    x = x_;
+    y = y_;
+    sp = 0xf0;
+    status = status_;
+    waiting6502 = 0;
+}
+
+static Engine _real_engine = { "bus", memory, _real_reset, step6502 };
+
+
+static void _setup(Engine *e, uint8_t op, int variant, uint8_t *x_, uint8_t *status_) {
+    /* write the instruction and its operands, returning the registers to run it with */
+    uint8_t *m = e->memory;
+    uint16_t target = variant == VAR_CROSS ? 0x02f0 : 0x0300;
+    int mode = opmode(op);
+
+    memset(m, 0, 0x10000);
+    m[0x80] = target & 0xff;
+    m[0x81] = target >> 8;
+    m[0x0300] = 0x00;
+    m[0x0301] = 0x04;
+    m[0xfffa] = m[0xfffc] = m[0xfffe] = 0x00;
+    m[0xfffb] = m[0xfffd] = m[0xffff] = 0x04;
+
+    m[0x0400] = op;
+    switch (mode) {
+        case OPBENCH_IMM:
+            m[0x0401] = 0x01;
+            break;
+        case OPBENCH_REL:
+            /* a taken branch back to $03ff crosses a page */
+            m[0x0401] = variant == VAR_CROSS ? 0xfd : 0x00;
+            break;
+        case OPBENCH_ZPREL:
+            m[0x0401] = 0x80;
+            break;
+        case OPBENCH_ABS: case OPBENCH_ABSX: case OPBENCH_ABSY:
+        case OPBENCH_IND: case OPBENCH_AINX:
+            m[0x0401] = target & 0xff;
+            m[0x0402] = target >> 8;
+            break;
+        default:
+            m[0x0401] = 0x80;
+            break;
+    }
+    *x_ = variant == VAR_CROSS && mode != OPBENCH_REL ? 0x20 : 0;
+    *status_ = FLAG_CONSTANT;
+    if (variant == VAR_BCD) *status_ |= FLAG_DECIMAL;
+    /* bmi, bvs, bcs and beq branch when their flag is set */
+    if (variant == VAR_CROSS && mode == OPBENCH_REL && (op & 0x20))
+        *status_ |= FLAG_SIGN | FLAG_OVERFLOW | FLAG_CARRY | FLAG_ZERO;
+}
+
+static double _time(Engine *e, uint8_t op, int variant, long n, uint32_t *ticks) {
+    /* best of three runs in nanoseconds per instruction */
+    uint8_t xy, st;
+    uint64_t t, best = UINT64_MAX;
+    long i;
+    int k;
+
+    _setup(e, op, variant, &xy, &st);
+    e->reset(0x0400, xy, xy, st);
+    *ticks = e->step();
+    for (k=0; k<3; k++) {
+        t = _usecs();
+        for (i=0; i<n; i++) {
+            e->reset(0x0400, xy, xy, st);
+            e->step();
+        }
+        t = _usecs() - t;
+        if (t < best) best = t;
+    }
+    return best * 1000.0 / n;
+}
+
+static int _cmp(const void *p, const void *q) {
+    const Result *a = p, *b = q;
+    return a->ns[1] < b->ns[1] ? 1 : (a->ns[1] > b->ns[1] ? -1 : a->op - b->op);
+}
+
+int main(int argc, char *argv[]) {
+    Engine *engines[2] = { &stub_engine, &_real_engine };
+    Result results[256*2], *r;
+    long n = argc > 1 ? strtol(argv[1], NULL, 0) : 100000;
+    int op, mode, variant, i, k, nresult = 0;
+
+    quiet = 1;
+    for (op=0; op<256; op++) {
+        mode = opmode(op);
+        for (variant=VAR_BASE; variant<=VAR_CROSS; variant++) {
+            if (variant == VAR_BCD && !stub_bcd(op)) continue;
+            if (variant == VAR_CROSS && mode != OPBENCH_ABSX && mode != OPBENCH_ABSY
+                    && mode != OPBENCH_INDY && !(mode == OPBENCH_REL)) continue;
+            r = results + nresult++;
+            r->op = op;
+            r->variant = variant;
+            for (k=0; k<2; k++) r->ns[k] = _time(engines[k], op, variant, n, &r->ticks);
+        }
+    }
+    qsort(results, nresult, sizeof(Result), _cmp);
+
+    printf("# c65 opcode benchmark, ns per instruction, best of 3 x %ld\n", n);
+    printf("op  name mode     variant ticks     stub      bus\n");
+    for (i=0; i<nresult; i++) {
+        r = results + i;
+        printf("%02x  %-4.4s %-8s %-7s %5u %8.2f %8.2f\n",
+            r->op, opname(r->op), opmodename(r->op), _varnames[r->variant],
+            r->ticks, r->ns[0], r->ns[1]);
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+/*
+An engine is a copy of the 6502 core attached to a bus.  reset sets
+the registers to run one instruction at pc, and step executes it.
+*/
+typedef struct Engine {
+    const char *name;
+    uint8_t *memory;
+    void (*reset)(uint16_t pc, uint8_t x, uint8_t y, uint8_t status);
+    uint32_t (*step)();
+} Engine;
+
+/* addressing modes, as returned by opmode() */
+enum {
+    OPBENCH_IMP, OPBENCH_ACC, OPBENCH_IMM, OPBENCH_ZP, OPBENCH_ZPX, OPBENCH_ZPY,
+    OPBENCH_IND0, OPBENCH_INDX, OPBENCH_INDY, OPBENCH_REL, OPBENCH_ZPREL,
+    OPBENCH_ABS, OPBENCH_ABSX, OPBENCH_ABSY, OPBENCH_IND, OPBENCH_AINX
+};
+
+extern Engine stub_engine;
+
+int stub_bcd(uint8_t op);
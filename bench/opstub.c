@@ -0,0 +1,33 @@
+/*
+A private copy of the fake65c02 core with a stub bus that just reads and
+writes an array, for comparison with the real read6502 and write6502 in c65.
+The core's global functions are renamed so both copies can link together.
+*/
+#include <stdint.h>
+
+#define CORE_COPY(name) stub_##name
+#include "corecopy.h"
+#include "opbench.h"
+
+uint8_t stub_memory[0x10000];
+
+uint8 read6502(ushort addr) { return stub_memory[addr]; }
+void write6502(ushort addr, uint8 val) { stub_memory[addr] = val; }
+
+static void _stub_reset(uint16_t pc_, uint8_t x_, uint8_t y_, uint8_t status_) {
+    pc = pc_;
+    a = 0x55;
+    x = x_;
+    y = y_;
+    sp = 0xf0;
+    status = status_;
+    waiting6502 = 0;
+}
+
+Engine stub_engine = { "stub", stub_memory, _stub_reset, step6502 };
+
+
+int stub_bcd(uint8_t op) {
+    /* does op depend on decimal mode? */
+    return optable[op] == adc || optable[op] == sbc;
+}
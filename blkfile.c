@@ -0,0 +1,468 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "blkfile.h"
+
+/*
+Sparse block container format.  All values are little-endian.
+
+    offset  size  description
+    0       4     magic "C65B"
+    4       2     format version (1)
+    6       2     reserved (0)
+    8       4     number of index entries
+    12      4     file offset of the index
+
+The index is a list of 16 byte entries, in any order:
+
+    0       4     block number
+    4       4     file offset of the stored block
+    8       2     stored length in bytes, 0 for a block that was zeroed
+    10      2     allocated length, i.e. room available for rewrites
+    12      1     codec: 0 = raw, 1 = run length encoded (PackBits)
+    13      3     reserved (0)
+
+Blocks without an entry, or with a stored length of 0, read as all zeros.
+Writing an all-zero block sets the length to 0 but keeps the allocation.
+Each entry keeps its slot in the index on disk, so a write only updates
+that one entry, after writing the data.  A rewritten block is stored in place
+if it fits its allocation, otherwise it's appended after the data and the index.
+A new block gets the next slot, and then the header counts it.  When the index
+fills the room before the data that follows it, it moves to the end of the file
+with twice the room, and the header then points to it.  So each write costs
+a constant number of small writes on average.  If c65 is killed, appended
+blocks and index moves are all or nothing, but a block rewritten in place
+can be left half old and half new, or with the wrong length in its entry.
+Use blk_pack to compact a container which has accumulated dead space,
+or to convert a flat file.
+*/
+
+#define BLK_MAGIC "C65B"
+#define BLK_VERSION 1
+#define BLK_HEADER 16
+#define BLK_ENTRY 16
+
+#define BLK_RAW 0
+#define BLK_RLE 1
+
+#ifdef WINDOWS_NATIVE
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+typedef struct BlkEntry {
+    uint32_t blknum, offset;
+    uint16_t length, alloc;
+    uint8_t codec;
+    uint32_t slot;          /* position in the index on disk */
+} BlkEntry;
+
+struct BlkFile {
+    FILE *f;
+    int container, dirty;
+    int deferred;           /* only write the index on close, see blk_pack */
+    uint32_t n, cap;        /* index entries in use and allocated, sorted by block number */
+    BlkEntry *index;
+    uint64_t end;           /* end of data, where new blocks are appended */
+    uint64_t ioff;          /* file offset of the index on disk */
+    uint32_t icap;          /* slots that fit at ioff, or n if the index ends the file */
+};
+
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p+2) << 16); }
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xffff); put16(p+2, v >> 16); }
+
+
+static int rle_encode(const uint8_t *src, uint8_t *dst) {
+    /* PackBits encode a block, returning the packed length or 0 if it doesn't shrink */
+    int i = 0, n = 0, run, lit;
+
+    while (i < BLK_SIZE) {
+        for (run=1; i+run < BLK_SIZE && run < 128 && src[i+run] == src[i]; run++) /**/ ;
+        if (run > 1) {
+            if (n + 2 >= BLK_SIZE) return 0;
+            dst[n++] = (uint8_t)(257 - run);
+            dst[n++] = src[i];
+            i += run;
+        } else {
+            /* gather literals up to the next run of three or more */
+            for (lit=1; i+lit < BLK_SIZE && lit < 128; lit++)
+                if (i+lit+2 < BLK_SIZE && src[i+lit] == src[i+lit+1] && src[i+lit] == src[i+lit+2]) break;
+            if (n + 1 + lit >= BLK_SIZE) return 0;
+            dst[n++] = (uint8_t)(lit - 1);
+            memcpy(dst+n, src+i, lit);
+            n += lit;
+            i += lit;
+        }
+    }
+    return n;
+}
+
+static int rle_decode(const uint8_t *src, int len, uint8_t *dst) {
+    int i = 0, n = 0, k, c;
+
+    while (i < len) {
+        c = src[i++];
+        if (c < 128) {
+            k = c + 1;
+            if (i + k > len || n + k > BLK_SIZE) return -1;
+            memcpy(dst+n, src+i, k);
+            i += k;
+        } else if (c > 128) {
+            k = 257 - c;
+            if (i >= len || n + k > BLK_SIZE) return -1;
+            memset(dst+n, src[i++], k);
+        } else {
+            k = 0;  /* 128 is a no-op */
+        }
+        n += k;
+    }
+    return n;
+}
+
+
+static uint32_t _find(const BlkFile *bf, uint32_t blknum) {
+    /* return the index of the first entry with block number >= blknum */
+    uint32_t lo = 0, hi = bf->n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (bf->index[mid].blknum < blknum) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int _cmp_entries(const void *p, const void *q) {
+    const BlkEntry *a = p, *b = q;
+    return (a->blknum > b->blknum) - (a->blknum < b->blknum);
+}
+
+static int _write_entry(BlkFile *bf, const BlkEntry *e) {
+    /* update the entry in its slot on disk */
+    uint8_t buf[BLK_ENTRY];
+
+    memset(buf, 0, sizeof(buf));
+    put32(buf, e->blknum);
+    put32(buf+4, e->offset);
+    put16(buf+8, e->length);
+    put16(buf+10, e->alloc);
+    buf[12] = e->codec;
+    if (
+        fseek64(bf->f, bf->ioff + (uint64_t)e->slot * BLK_ENTRY, SEEK_SET)
+        || fwrite(buf, sizeof(buf), 1, bf->f) != 1
+    ) return -1;
+    return 0;
+}
+
+static int _write_header(BlkFile *bf) {
+    uint8_t hdr[BLK_HEADER];
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, BLK_MAGIC, 4);
+    put16(hdr+4, BLK_VERSION);
+    put32(hdr+8, bf->n);
+    put32(hdr+12, (uint32_t)bf->ioff);
+    fflush(bf->f);
+    if (fseek64(bf->f, 0, SEEK_SET) || fwrite(hdr, sizeof(hdr), 1, bf->f) != 1) return -1;
+    fflush(bf->f);
+    return 0;
+}
+
+static int _write_index(BlkFile *bf, uint32_t icap) {
+    /* write the whole index after the data with room for icap entries, then point the header at it */
+    uint32_t i;
+
+    if (bf->end > 0xffffffff - (uint64_t)icap * BLK_ENTRY) return -1;
+    bf->ioff = bf->end;
+    bf->icap = icap;
+    for (i=0; i<bf->n; i++) {
+        bf->index[i].slot = i;
+        if (_write_entry(bf, bf->index + i)) return -1;
+    }
+    if (_write_header(bf)) return -1;
+    bf->dirty = 0;
+    return 0;
+}
+
+static int _make_room(BlkFile *bf, uint32_t need) {
+    /* make sure data appended at end can't overwrite an index of need entries */
+    uint32_t icap = 2 * need > 64 ? 2 * need : 64;
+
+    if (bf->end <= bf->ioff) {
+        /* the index ends the file, so it can stay put with room after it */
+        if (bf->ioff > 0xffffffff - (uint64_t)icap * BLK_ENTRY) return -1;
+        bf->icap = icap;
+        bf->end = bf->ioff + (uint64_t)icap * BLK_ENTRY;
+    } else if (need > bf->icap) {
+        /* otherwise move it to the end, leaving the old one as dead space */
+        if (_write_index(bf, icap)) return -1;
+        bf->end += (uint64_t)icap * BLK_ENTRY;
+    }
+    return 0;
+}
+
+static int _update(BlkFile *bf, const BlkEntry *e) {
+    bf->dirty = 1;
+    if (bf->deferred) return 0;
+    if (_write_entry(bf, e)) return -1;
+    fflush(bf->f);
+    return 0;
+}
+
+
+BlkFile* blk_open(const char *fname) {
+    BlkFile *bf;
+    FILE *f;
+    uint8_t hdr[BLK_HEADER], e[BLK_ENTRY];
+    uint64_t first = UINT64_MAX, size;
+    uint32_t i;
+
+    if (!(f = fopen(fname, "r+b"))) {
+        fprintf(stderr, "File not found: %s\n", fname);
+        return NULL;
+    }
+    bf = calloc(1, sizeof(BlkFile));
+    bf->f = f;
+    if (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) && 0 == memcmp(hdr, BLK_MAGIC, 4)) {
+        bf->container = 1;
+        if (get16(hdr+4) != BLK_VERSION) {
+            fprintf(stderr, "Unsupported block container version %d in %s\n", get16(hdr+4), fname);
+            blk_close(bf);
+            return NULL;
+        }
+        /* don't trust the entry count in a corrupt or truncated header */
+        bf->ioff = get32(hdr+12);
+        fseek64(f, 0, SEEK_END);
+        size = ftell64(f);
+        if (bf->ioff < BLK_HEADER || bf->ioff + (uint64_t)get32(hdr+8) * BLK_ENTRY > size) {
+            fprintf(stderr, "Truncated block index in %s\n", fname);
+            blk_close(bf);
+            return NULL;
+        }
+        bf->n = bf->cap = get32(hdr+8);
+        if (!(bf->index = malloc((bf->cap ? bf->cap : 1) * sizeof(BlkEntry)))) {
+            fprintf(stderr, "Out of memory for the block index in %s\n", fname);
+            bf->n = 0;
+            blk_close(bf);
+            return NULL;
+        }
+        fseek64(f, bf->ioff, SEEK_SET);
+        for (i=0; i<bf->n; i++) {
+            if (fread(e, sizeof(e), 1, f) != 1) {
+                fprintf(stderr, "Truncated block index in %s\n", fname);
+                bf->n = 0;
+                blk_close(bf);
+                return NULL;
+            }
+            bf->index[i].blknum = get32(e);
+            bf->index[i].offset = get32(e+4);
+            bf->index[i].length = get16(e+8);
+            bf->index[i].alloc = get16(e+10);
+            bf->index[i].codec = e[12];
+            bf->index[i].slot = i;
+        }
+        qsort(bf->index, bf->n, sizeof(BlkEntry), _cmp_entries);
+        /* new blocks go after the data, and the index has room up to the first block after it */
+        bf->end = BLK_HEADER;
+        for (i=0; i<bf->n; i++) {
+            if (bf->index[i].offset + bf->index[i].alloc > bf->end)
+                bf->end = bf->index[i].offset + bf->index[i].alloc;
+            if (bf->index[i].offset >= bf->ioff && bf->index[i].offset < first)
+                first = bf->index[i].offset;
+        }
+        bf->icap = first == UINT64_MAX ? bf->n : (uint32_t)((first - bf->ioff) / BLK_ENTRY);
+    }
+    return bf;
+}
+
+void blk_close(BlkFile *bf) {
+    if (!bf) return;
+    if (bf->container && bf->dirty && bf->deferred && _write_index(bf, bf->n))
+        fprintf(stderr, "Error writing block index\n");
+    fclose(bf->f);
+    free(bf->index);
+    free(bf);
+}
+
+int blk_is_container(const BlkFile *bf) {
+    return bf->container;
+}
+
+uint64_t blk_count(BlkFile *bf) {
+    /* one more than the last block number stored, or that fits in a flat file */
+    if (bf->container) return bf->n ? (uint64_t)bf->index[bf->n-1].blknum + 1 : 0;
+    if (fseek64(bf->f, 0, SEEK_END)) return 0;
+    return ((uint64_t)ftell64(bf->f) + BLK_SIZE - 1) / BLK_SIZE;
+}
+
+
+int blk_read(BlkFile *bf, uint32_t blknum, uint8_t *buf) {
+    uint8_t packed[BLK_SIZE];
+    const BlkEntry *e;
+    uint32_t i;
+
+    if (!bf->container) {
+        /* a short read past the end of a flat file leaves buf unchanged */
+        if (fseek64(bf->f, (int64_t)BLK_SIZE * blknum, SEEK_SET)) return -1;
+        (void)fread(buf, 1, BLK_SIZE, bf->f);
+        return 0;
+    }
+    i = _find(bf, blknum);
+    if (i == bf->n || bf->index[i].blknum != blknum || !bf->index[i].length) {
+        memset(buf, 0, BLK_SIZE);
+        return 0;
+    }
+    e = bf->index + i;
+    if (
+        fseek64(bf->f, e->offset, SEEK_SET)
+        || e->length > BLK_SIZE
+        || fread(packed, 1, e->length, bf->f) != e->length
+    ) return -1;
+
+    if (e->codec == BLK_RLE) return rle_decode(packed, e->length, buf) == BLK_SIZE ? 0 : -1;
+    if (e->codec != BLK_RAW || e->length != BLK_SIZE) return -1;
+    memcpy(buf, packed, BLK_SIZE);
+    return 0;
+}
+
+int blk_write(BlkFile *bf, uint32_t blknum, const uint8_t *buf) {
+    uint8_t packed[BLK_SIZE];
+    const uint8_t *data;
+    BlkEntry *e;
+    uint32_t i;
+    uint64_t offset;
+    int k, len, found;
+
+    if (!bf->container) {
+        if (
+            fseek64(bf->f, (int64_t)BLK_SIZE * blknum, SEEK_SET)
+            || fwrite(buf, BLK_SIZE, 1, bf->f) != 1
+        ) return -1;
+        fflush(bf->f);
+        return 0;
+    }
+
+    i = _find(bf, blknum);
+    found = i < bf->n && bf->index[i].blknum == blknum;
+    e = bf->index + i;
+
+    /* elide all-zero blocks, keeping the allocation for a later rewrite */
+    for (k=0; k<BLK_SIZE && !buf[k]; k++) /**/ ;
+    if (k == BLK_SIZE) {
+        if (!found || !e->length) return 0;
+        e->length = 0;
+        e->codec = BLK_RAW;
+        return _update(bf, e);
+    }
+
+    if ((len = rle_encode(buf, packed))) {
+        data = packed;
+    } else {
+        data = buf;
+        len = BLK_SIZE;
+    }
+
+    /* rewrite in place if it fits, otherwise append clear of the index */
+    if (found && len <= e->alloc) {
+        offset = e->offset;
+    } else {
+        if (!bf->deferred && _make_room(bf, bf->n + !found)) return -1;
+        offset = bf->end;
+    }
+    if (offset + len > 0xffffffff) return -1;
+    if (
+        fseek64(bf->f, offset, SEEK_SET)
+        || fwrite(data, len, 1, bf->f) != 1
+    ) return -1;
+    fflush(bf->f);
+
+    if (!found) {
+        if (bf->n == bf->cap) {
+            bf->cap = bf->cap ? 2 * bf->cap : 64;
+            bf->index = realloc(bf->index, bf->cap * sizeof(BlkEntry));
+        }
+        memmove(bf->index + i + 1, bf->index + i, (bf->n - i) * sizeof(BlkEntry));
+        e = bf->index + i;
+        e->slot = bf->n++;
+    }
+    e->blknum = blknum;
+    e->length = len;
+    e->codec = data == packed ? BLK_RLE : BLK_RAW;
+    if (offset == bf->end) {
+        e->offset = (uint32_t)offset;
+        e->alloc = len;
+        bf->end += len;
+    }
+    /* a new entry only counts once the header includes its slot */
+    if (_update(bf, e)) return -1;
+    return found || bf->deferred ? 0 : _write_header(bf);
+}
+
+int blk_pack(const char *src, const char *dst) {
+    /*
+    copy a flat or container block file to a new, compact container,
+    returning the number of non-zero blocks stored or -1 on error
+    */
+    BlkFile *in, *out;
+    FILE *f;
+    uint8_t hdr[BLK_HEADER], buf[BLK_SIZE];
+    uint64_t nblk, k;
+    uint32_t blknum;
+    int n = 0, err = 0;
+
+    if (0 == strcmp(src, dst)) {
+        fprintf(stderr, "Can't pack %s in place\n", src);
+        return -1;
+    }
+    if (!(in = blk_open(src))) return -1;
+
+    /* start with an empty container, with the index immediately after the header */
+    if (!(f = fopen(dst, "wb"))) {
+        fprintf(stderr, "Error writing %s\n", dst);
+        blk_close(in);
+        return -1;
+    }
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, BLK_MAGIC, 4);
+    put16(hdr+4, BLK_VERSION);
+    put32(hdr+12, BLK_HEADER);
+    fwrite(hdr, sizeof(hdr), 1, f);
+    fclose(f);
+    if (!(out = blk_open(dst))) {
+        blk_close(in);
+        return -1;
+    }
+    out->deferred = 1;
+
+    if (in->container) {
+        nblk = in->n;
+    } else {
+        fseek64(in->f, 0, SEEK_END);
+        nblk = (ftell64(in->f) + BLK_SIZE - 1) / BLK_SIZE;
+    }
+    for (k=0; k<nblk && !err; k++) {
+        blknum = in->container ? in->index[k].blknum : (uint32_t)k;
+        memset(buf, 0, BLK_SIZE);
+        err = blk_read(in, blknum, buf) || blk_write(out, blknum, buf);
+    }
+    n = out->n;
+    /* make sure we have an index even if there were no blocks */
+    out->dirty = 1;
+    blk_close(out);
+    blk_close(in);
+    if (err) {
+        fprintf(stderr, "Error packing %s to %s\n", src, dst);
+        return -1;
+    }
+    return n;
+}
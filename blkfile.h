@@ -0,0 +1,21 @@
+/*
+Block storage backing the magic blkio interface.
+
+A block file is either a flat binary, with block k at offset k*1024,
+or a sparse container (see blkfile.c) which elides all-zero blocks
+and optionally compresses the rest.  The format is detected on open.
+*/
+
+#define BLK_SIZE 1024
+
+typedef struct BlkFile BlkFile;
+
+BlkFile* blk_open(const char *fname);
+void blk_close(BlkFile *bf);
+int blk_is_container(const BlkFile *bf);
+uint64_t blk_count(BlkFile *bf);
+
+int blk_read(BlkFile *bf, uint32_t blknum, uint8_t *buf);
+int blk_write(BlkFile *bf, uint32_t blknum, const uint8_t *buf);
+
+int blk_pack(const char *src, const char *dst);
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <ctype.h>
 
@@ -13,16 +14,42 @@
 #include "c65.h"
 #include "magicio.h"
 #include "monitor.h"
+#include "snapshot.h"
+#include "reverse.h"
+#include "journal.h"
+#include "stats.h"
+#include "lockstep.h"
+#include "profile.h"
 
 uint8_t memory[0x10000];
 uint8_t breakpoints[0x10000];
 uint64_t heat_rs[0x10000];
 uint64_t heat_ws[0x10000];
 uint64_t heat_xs[0x10000];
+uint64_t heat_cs[0x10000];     /* cycles by opcode address, including penalties */
+/* taken and not taken counts for relative branches, with taken and page crossing cycles */
+uint64_t branch_taken[0x10000], branch_not[0x10000], branch_extra[0x10000];
+/* page crossing penalty cycles for indexed modes by opcode address */
+uint64_t page_crossings[0x10000];
+uint8_t dirty_pages[0x100];
+int heat_on = 1;    /* --no-heat skips the heatmap counts, e.g. to benchmark */
+
+/* executions, cycles and page crossing or branch penalty cycles by opcode, see opstats */
+int opstats_on = 0;
+uint64_t op_counts[256], op_ticks[256], op_penalty[256];
+
+/* bus accesses, counted only while the profiler or a region needs them */
+int bus_counting = 0;
+uint64_t bus_reads = 0, bus_writes = 0;
 
 uint64_t ticks = 0;
 
 int break_flag = 0, step_mode = STEP_RUN, step_target = -1, quiet = 0;
+int exit_code = 0;
+
+/* run limits from -T and --timeout, checked whenever ticks reaches limit_due */
+uint64_t max_ticks = UINT64_MAX, deadline = 0;
+static uint64_t limit_due = UINT64_MAX;
 uint16_t rw_brk;
 
 static uint8_t _opmodes[256] = { 255 };
@@ -46,6 +73,11 @@ static const char* _opfmts[] = {
     "%s,%s  ; %+d", "%s", "%s,x", "%s,y", "(%s)", "(%s,x)"
 };
 
+static const char* _opmodenames[] = {
+    "", "a", "#", "zp", "zp,x", "zp,y", "(zp)", "(zp,x)", "(zp),y",
+    "rel", "zp,rel", "abs", "abs,x", "abs,y", "(abs)", "(abs,x)"
+};
+
 
 const char* opname(uint8_t op) {
     return opnames + op*4;
@@ -74,10 +106,15 @@ const char* opfmt(uint8_t op) {
     return _opfmts[opmode(op)];
 }
 
+const char* opmodename(uint8_t op) {
+    return _opmodenames[opmode(op)];
+}
+
 
 uint8_t read6502(uint16_t addr) {
   io_magic_read(addr);
-  heat_rs[addr] += 1;
+  if (heat_on) heat_rs[addr] += 1;
+  if (bus_counting) bus_reads++;
   if (breakpoints[addr] & MONITOR_READ) {
     break_flag |= MONITOR_READ;
     rw_brk = addr;
@@ -87,7 +124,10 @@ uint8_t read6502(uint16_t addr) {
 
 void write6502(uint16_t addr, uint8_t val) {
   io_magic_write(addr, val);
-  heat_ws[addr] += 1;
+  if (lockstep_on) lockstep_write(addr, val);
+  if (heat_on) heat_ws[addr] += 1;
+  if (bus_counting) bus_writes++;
+  dirty_pages[addr >> 8] = 1;
   if (breakpoints[addr] & MONITOR_WRITE) {
     break_flag |= MONITOR_WRITE;
     rw_brk = addr;
@@ -95,6 +135,16 @@ void write6502(uint16_t addr, uint8_t val) {
   memory[addr] = val;
 }
 
+void mark_dirty(uint16_t start, uint32_t len) {
+  /* flag pages changed by host-side writes to memory[], wrapping at the top of memory */
+  uint32_t p;
+
+  if (!len) return;
+  for (p = start >> 8; p <= (start + len - 1) >> 8; p++)
+    dirty_pages[p & 0xff] = 1;
+  if (lockstep_on) lockstep_copy(start, len);
+}
+
 const char *_flags = "nv bdizc";
 int get_reg_or_flag(const char *name) {
     const char *q;
@@ -166,6 +216,7 @@ int load_memory(const char* romfile, int addr) {
     printf("c65: reading %s to $%04x:$%04x\n", romfile, addr, addr+sz-1);
   fread(memory + addr, 1, sz, fin);
   fclose(fin);
+  mark_dirty(addr, sz);
   return 0;
 }
 
@@ -177,12 +228,30 @@ int save_memory(const char* romfile, uint16_t start, uint16_t end) {
     return -1;
   }
   if (!quiet)
-    printf("c65: writing $%04x:$%04x to %s", start, end, romfile);
+    printf("c65: writing $%04x:$%04x to %s\n", start, end, romfile);
   fwrite(memory+start, 1, (end < start ? 0x10000 : end) - start + 1, fout);
   fclose(fout);
   return 0;
 }
 
+void check_limits() {
+  /*
+  stop the run at the cycle limit or wall clock deadline.  we check the clock
+  every 64K ticks, and magic IO also checks while the guest polls for input
+  */
+  if (ticks >= max_ticks) {
+    fprintf(stderr, "c65: stopped at cycle limit %" PRIu64 "\n", max_ticks);
+  } else if (deadline && _usecs() >= deadline) {
+    fprintf(stderr, "c65: stopped at timeout\n");
+  } else {
+    limit_due = deadline && ticks + 0x10000 < max_ticks ? ticks + 0x10000 : max_ticks;
+    return;
+  }
+  exit_code = 124;
+  break_flag |= MONITOR_EXIT;
+  limit_due = UINT64_MAX;
+}
+
 void show_cpu() {
   if (!quiet)
     printf(
@@ -195,13 +264,36 @@ void show_cpu() {
     );
 }
 
+#ifndef C65_NO_MAIN
+/* the benchmarks link c65 without main to use its bus, see bench/opbench.c */
 int main(int argc, char *argv[]) {
-  const char *romfile = NULL, *labelfile = NULL;
+  const char *romfile = NULL, *labelfile = NULL, *replayfile = NULL, *inputfile = NULL;
+  const char *statsfile = NULL, *listfile = NULL;
+  uint64_t delay = 0;
+  double timeout = 0;
   int addr = -1, start = -1, debug = 0, errflg = 0, c;
   int brk_action = MONITOR_EXIT;
-  uint16_t over_addr;
-
-  while ((c = getopt(argc, argv, "vxgqr:a:s:m:b:l:")) != -1) {
+  uint16_t over_addr, op_addr;
+  uint32_t dt;
+  int once;
+  int nsnap = 0, headless = 0, err = 0, stats_top = 10, lockstep = 0;
+  const char *snapfiles[8];
+
+  const struct option longopts[] = {
+    {"timeout", required_argument, NULL, 'W'},
+    {"stats", required_argument, NULL, 'Z'},
+    {"stats-top", required_argument, NULL, 'N'},
+    {"no-heat", no_argument, &heat_on, 0},
+    {"lockstep", no_argument, &lockstep, 1},
+    {"opstats", no_argument, &opstats_on, 1},
+    {"profile", no_argument, NULL, 'P'},
+    {"sample", required_argument, NULL, 'Y'},
+    {"timers", required_argument, NULL, 'K'},
+    {"guest-ctl", no_argument, &io_guest_ctl, 1},
+    {NULL, 0, NULL, 0}
+  };
+
+  while ((c = getopt_long(argc, argv, "vxgqXr:a:s:m:b:f:i:c:l:S:j:J:e:E:T:L:", longopts, NULL)) != -1) {
     switch (c) {
       case 'r':
         romfile = optarg;
@@ -219,14 +311,86 @@ int main(int argc, char *argv[]) {
         io_addr = strtol(optarg, NULL, 0);
         break;
 
+      case 'K':
+        io_taddr = strtol(optarg, NULL, 0) & 0xffff;
+        break;
+
       case 'b':
         io_blkfile(optarg);
         break;
 
+      case 'f':
+        io_filedir(optarg);
+        break;
+
+      case 'i':
+        inputfile = optarg;
+        break;
+
+      case 'c':
+        delay = strtoull(optarg, NULL, 0);
+        break;
+
       case 'l':
         labelfile = optarg;
         break;
 
+      case 'L':
+        listfile = optarg;
+        break;
+
+      case 'S':
+        if (nsnap < 8) snapfiles[nsnap++] = optarg;
+        break;
+
+      case 'j':
+        journal_record_to(optarg);
+        break;
+
+      case 'J':
+        replayfile = optarg;
+        break;
+
+      case 'e':
+        monitor_script(optarg);
+        headless = 1;
+        break;
+
+      case 'E':
+        if (monitor_script_file(optarg) != 0) exit(3);
+        headless = 1;
+        break;
+
+      case 'X':
+        monitor_exit_on_error = 1;
+        break;
+
+      case 'T':
+        max_ticks = strtoull(optarg, NULL, 0);
+        break;
+
+      case 'W':
+        timeout = strtod(optarg, NULL);
+        break;
+
+      case 'Z':
+        statsfile = optarg;
+        break;
+
+      case 'P':
+        profile_enable(1);
+        break;
+
+      case 'Y':
+        /* sampling is for speed, so skip the heatmap too */
+        heat_on = 0;
+        profile_sample(strtoul(optarg, NULL, 0));
+        break;
+
+      case 'N':
+        stats_top = strtol(optarg, NULL, 0);
+        break;
+
       case 'g':
         debug++;
         /* fall through */
@@ -248,18 +412,20 @@ int main(int argc, char *argv[]) {
         exit(1);
 
       case '?':
-        fprintf(stderr, "Unrecognized option: '-%c'\n", optopt);
+        /* optopt is 0 for an unknown long option */
+        if (optopt) fprintf(stderr, "Unrecognized option: '-%c'\n", optopt);
+        else fprintf(stderr, "Unrecognized option: '%s'\n", argv[optind-1]);
         errflg++;
         break;
     }
   }
 
-  if (romfile == NULL)
+  if (romfile == NULL && nsnap == 0)
     errflg++;
 
   if (errflg) {
     fprintf(stderr,
-            "Usage: c65 -r file.rom [...]\n"
+            "Usage: c65 -r file.rom [...] or c65 -S file.snap [...]\n"
             "Options:\n"
             "-?         : Show this message\n"
             "-v         : Show semantic version\n"
@@ -268,27 +434,64 @@ int main(int argc, char *argv[]) {
             "-a <addr>  : Load at address instead of aligning to end of memory\n"
             "-s <addr>  : Start executing at addr instead of via reset vector\n"
             "-m <addr>  : Set magic IO base address (default 0xf000)\n"
+            "--timers <addr> : Add the magic IO timer block at addr, e.g. 0xf030\n"
+            "--guest-ctl : Let the guest set the exit status and regions via magic IO\n"
             "-b <file>  : Use binary file for magic block storage\n"
+            "-f <dir>   : Enable magic file IO for files in dir\n"
+            "-i <file>  : Read console input from file on virtual time\n"
+            "-c <ticks> : With -i, delay each input character by ticks cycles\n"
             "-l <file>  : Read VICE format labels from file (implies -g)\n"
+            "-L <file>  : Read a 64tass listing for profile source positions\n"
+            "-S <file>  : Resume from snapshot file (after loading any -r file),\n"
+            "             repeat to apply an incremental snapshot to its base\n"
+            "-j <file>  : Record magic IO inputs to a journal file on exit\n"
+            "-J <file>  : Replay magic IO inputs from a journal file\n"
             "-x         : BRK should reset via $fffe rather than exit (implied by -g)\n"
             "-g         : Run with interactive debugger\n"
+            "-e <cmds>  : Run debugger commands separated by ; without interaction\n"
+            "-E <file>  : Run debugger commands from file without interaction\n"
+            "-X         : With -e or -E, exit with status 1 after a failed command\n"
+            "-T <ticks> : Stop after ticks cycles with exit status 124\n"
+            "--timeout <secs> : Stop after secs seconds with exit status 124\n"
+            "--stats <file> : Write run statistics to file as JSON on exit\n"
+            "--stats-top <n> : Include the n most executed addresses (default 10)\n"
+            "--no-heat  : Don't count memory accesses for heatmap, e.g. to benchmark\n"
+            "--lockstep : Check an alternative CPU engine against the reference core\n"
+            "--opstats  : Count executions and cycles by opcode, see the opstats command\n"
+            "--profile  : Profile cycles by subroutine, see the profile command\n"
+            "--sample <cycles> : Profile by sampling about every so many cycles, implies --no-heat\n"
             "-gg        : Debug but don't break on startup\n"
             "Note: write <addr> like 8192 (decimal) or 0x2000 (hex)\n");
     exit(2);
   }
 
-  if (load_memory(romfile, addr) != 0) exit(3);
+  if (romfile && load_memory(romfile, addr) != 0) exit(3);
 
   reset6502();
+  for (c=0; c<nsnap; c++)
+    if (snapshot_load(snapfiles[c]) != 0) exit(3);
   if (start >= 0)
     pc = (uint16_t)start;
+  if (replayfile && journal_load(replayfile) != 0) exit(3);
+  if (inputfile && io_input(inputfile, delay) != 0) exit(3);
+  if (listfile && profile_listing(listfile) != 0) exit(3);
   show_cpu();
 
   /* -l implies debug, but don't want -g -l to behave like -gg, see #3 */
   if (labelfile && !debug) debug = 1;
+  /* headless scripts start in the debugger, and exit when they run out */
+  if (headless) {
+    debug = 1;
+    brk_action = MONITOR_BRK;
+  }
 
   io_init(debug);
+  if (timeout > 0) deadline = _usecs() + (uint64_t)(timeout * 1e6);
+  check_limits();
+  stats_start();
   if (debug) monitor_init(labelfile);
+  /* without the debugger, a divergence stops the run with exit status 1 */
+  if (lockstep) lockstep_enable(debug ? MONITOR_SIGINT : MONITOR_EXIT);
 
   /*
   The simulator runs in one of several states:
@@ -314,26 +517,60 @@ int main(int argc, char *argv[]) {
         } while (step_mode == STEP_NONE && !(break_flag & MONITOR_EXIT)) ;
       }
       debug = 1;
+      reverse_checkpoint();
+      if (lockstep_on) lockstep_sync();
     }
     /* clear break flag except monitor exit status */
     break_flag &= MONITOR_EXIT;
+    once = 0;
     while (!break_flag && (step_mode == STEP_RUN || step_target)) {
       if (step_mode == STEP_NEXT && memory[pc] == 0x20) { /* JSR ? */
         step_mode = STEP_OVER;
         over_addr = pc+3;
       }
-      heat_xs[pc]++;
-      ticks += step6502();
+      if (ticks >= limit_due) check_limits();
+      if (ticks >= reverse_due) reverse_checkpoint();
+      if (ticks >= heat_record_due) heat_record();
+      if (heat_on) heat_xs[pc]++;
+      op_addr = pc;
+      dt = lockstep_on ? lockstep_step() : step6502();
+      ticks += dt;
+      if (heat_on) {
+        heat_cs[op_addr] += dt;
+        if (addrtable[opcode] == rel || addrtable[opcode] == zprel) {
+          /* a taken branch always costs extra, even to the next instruction */
+          if (dt > ticktable[opcode]) branch_taken[op_addr]++;
+          else branch_not[op_addr]++;
+          branch_extra[op_addr] += dt - ticktable[opcode];
+        }
+        if (penaltyop && penaltyaddr) page_crossings[op_addr]++;
+      }
+      if (opstats_on) {
+        op_counts[opcode]++;
+        op_ticks[opcode] += dt;
+        if (dt > ticktable[opcode]) op_penalty[opcode] += dt - ticktable[opcode];
+      }
       if (step_mode == STEP_OVER && pc == over_addr) step_mode = STEP_NEXT;
       if (opcode == 0x00) break_flag |= brk_action;  /* BRK ? */
+      if (profile_on) profile_step(op_addr, dt);
       if (breakpoints[pc] & MONITOR_PC) {
         break_flag |= MONITOR_PC;
-        if (breakpoints[pc] & MONITOR_ONCE) breakpoints[pc] ^= (MONITOR_ONCE|MONITOR_PC);
+        if (breakpoints[pc] & MONITOR_ONCE) {
+          breakpoints[pc] ^= (MONITOR_ONCE|MONITOR_PC);
+          once = 1;
+        }
       }
       if (step_mode == STEP_NEXT || step_mode == STEP_INST) step_target--;
     }
+    /* count breakpoints the user set, not the temporary ones from call or continue */
+    if ((break_flag & (MONITOR_DATA|MONITOR_BRK)) || ((break_flag & MONITOR_PC) && !once)) stats_breaks++;
   }
   show_cpu();
+  /* before io_exit, which resets the block statistics */
+  if (statsfile && stats_write(statsfile, stats_top) != 0) err = 3;
   io_exit();
-  if (debug) monitor_exit();
+  /* keep the first error, e.g. a failed stats write */
+  if (debug && monitor_exit() && !err) err = 1;
+  return err ? err : exit_code;
 }
+#endif
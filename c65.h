@@ -19,23 +19,42 @@
 
 extern uint8_t memory[0x10000];
 extern uint8_t breakpoints[0x10000];
+extern uint8_t dirty_pages[0x100];
 
 extern uint16_t pc;
-extern uint8_t a, x, y, sp, status;
+extern uint8_t a, x, y, sp, status, opcode, waiting6502;
+extern unsigned long long instructions;
 extern uint16_t rw_brk;
 
-extern uint64_t heat_rs[0x10000], heat_ws[0x10000], heat_xs[0x10000];
+extern uint64_t heat_rs[0x10000], heat_ws[0x10000], heat_xs[0x10000], heat_cs[0x10000];
+extern uint64_t branch_taken[0x10000], branch_not[0x10000], branch_extra[0x10000];
+extern uint64_t page_crossings[0x10000];
+extern int heat_on;
 
+extern int opstats_on;
+extern uint64_t op_counts[256], op_ticks[256], op_penalty[256];
+
+/* bus_counting flags for the features that need bus_reads and bus_writes */
+#define BUS_PROFILE 1
+#define BUS_REGIONS 2
+
+extern int bus_counting;
+extern uint64_t bus_reads, bus_writes;
 extern uint64_t ticks;
-extern int break_flag, step_mode, step_target, quiet;
+extern int break_flag, step_mode, step_target, quiet, exit_code;
 
 const char* opname(uint8_t op);
+uint8_t opmode(uint8_t op);
 uint8_t oplen(uint8_t op);
 const char* opfmt(uint8_t op);
+const char* opmodename(uint8_t op);
 
 int get_reg_or_flag(const char *name);
 int set_reg_or_flag(const char *name, int v);
 
+void mark_dirty(uint16_t start, uint32_t len);
+void check_limits();
+
 int load_memory(const char* romfile, int addr);
 int save_memory(const char* romfile, uint16_t start, uint16_t end);
 
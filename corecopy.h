@@ -0,0 +1,27 @@
+/*
+Include a second copy of a 6502 core in the same program as fake65c02.h.
+Define CORE_COPY to add a prefix to the core's global functions, and
+CORE_FILE if it isn't fake65c02.h, before including this, like:
+
+    #define CORE_COPY(name) alt_##name
+    #include "corecopy.h"
+*/
+#ifndef CORE_FILE
+#define CORE_FILE "fake65c02.h"
+#endif
+
+#define reset6502 CORE_COPY(reset6502)
+#define nmi6502 CORE_COPY(nmi6502)
+#define irq6502 CORE_COPY(irq6502)
+#define exec6502 CORE_COPY(exec6502)
+#define step6502 CORE_COPY(step6502)
+#define hookexternal CORE_COPY(hookexternal)
+#define callexternal CORE_COPY(callexternal)
+#define loopexternal CORE_COPY(loopexternal)
+#define read6502 CORE_COPY(read6502)
+#define write6502 CORE_COPY(write6502)
+
+/* the core has a helper variable it never uses, which only warns when static */
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include CORE_FILE
+#pragma GCC diagnostic warning "-Wunused-variable"
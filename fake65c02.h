@@ -111,10 +111,11 @@
  * uint32 clockticks6502                             *
  *   - A running total of the emulated cycle count   *
  *     during a call to exec6502.                    *
- * uint32 instructions                               *
+ * unsigned long long instructions                   *
  *   - A running total of the total emulated         *
  *     instruction count. This is not related to     *
- *     clock cycle timing.                           *
+ *     clock cycle timing.  (64-bit for c65, which   *
+ *     uses it to locate points in the history.)     *
  *                                                   *
  *****************************************************/
 
@@ -215,7 +216,7 @@ extern uint32 step6502();
 ushort pc;
 uint8 sp, a, x, y, status;
 /*helper variables*/
-uint32 instructions = 0;
+unsigned long long instructions = 0;
 uint32 clockticks6502 = 0;
 uint32 clockgoal6502 = 0;
 ushort oldpc, ea, reladdr, value, result;
@@ -230,7 +231,7 @@ void hookexternal(void *funcptr);
 #else
 static ushort pc;
 static uint8 sp, a, x, y, status;
-static uint32 instructions = 0;
+static unsigned long long instructions = 0;
 static uint32 clockticks6502 = 0;
 static uint32 clockgoal6502 = 0;
 static ushort oldpc, ea, reladdr, value, result;
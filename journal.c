@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "journal.h"
+#include "magicio.h"
+#include "c65.h"
+
+/*
+Journal records are stored little-endian, ready to write to a file:
+
+    offset  size  description
+    0       1     kind, e.g. JR_KBHIT
+    1       1     number of patches
+    2       2     repeat count, for identical events at regular intervals
+    4       4     ticks between repeats
+    8       8     ticks at the first event
+
+followed by the patches, each an address (2), a length (2) and the bytes
+which the host wrote to memory at that address.  Consecutive identical
+polls, like a guest spinning on kbhit, merge into a single record.
+
+A journal position holds the offset of a record with a repeat index
+in the low 16 bits.
+
+A journal file is an eight byte header with the magic "C65J", a format
+version (2 bytes) and two reserved bytes, followed by the records.
+Replaying a recorded file from the start reproduces the original run
+exactly, since every other input to the simulation is deterministic.
+*/
+
+#define JR_MAGIC "C65J"
+#define JR_VERSION 1
+#define JR_HEADER 16
+
+int journal_on = 0;
+
+static struct {
+    uint8_t *buf;
+    size_t len, cap;
+    size_t last;        /* offset of the last record */
+    int merge;          /* can the next event merge with the last record? */
+    size_t rec;         /* replay position, rec == len when live */
+    unsigned idx;
+} jr;
+
+static char *jr_fname = NULL;    /* write the journal here on exit */
+
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p+2) << 16); }
+static uint64_t get64(const uint8_t *p) { return get32(p) | ((uint64_t)get32(p+4) << 32); }
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xffff); put16(p+2, v >> 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, v & 0xffffffff); put32(p+4, v >> 32); }
+
+
+static size_t _reclen(const uint8_t *p) {
+    size_t n = JR_HEADER;
+    int i;
+
+    for (i=0; i<p[1]; i++) n += 4 + get16(p + n + 2);
+    return n;
+}
+
+static size_t _complete(const uint8_t *p, size_t avail) {
+    /* the length of the record at p, or 0 if it doesn't fit in avail bytes */
+    size_t n = JR_HEADER;
+    int i;
+
+    if (avail < n) return 0;
+    for (i=0; i<p[1]; i++) {
+        if (avail < n + 4 || avail < (n += 4 + get16(p + n + 2))) return 0;
+    }
+    return n;
+}
+
+static int _same_patch(const uint8_t *q, uint16_t addr, uint16_t len) {
+    int i;
+
+    if (get16(q) != addr || get16(q+2) != len) return 0;
+    for (i=0; i<len; i++)
+        if (q[4+i] != memory[(uint16_t)(addr + i)]) return 0;
+    return 1;
+}
+
+
+void journal_record(int kind, int npatch, const uint16_t *addrs, const uint16_t *lens) {
+    /* append the memory the host just wrote for an input event */
+    uint8_t *p;
+    size_t n = JR_HEADER;
+    uint64_t dt;
+    uint16_t rep;
+    int i, j;
+
+    if (!journal_on) return;
+    for (i=0; i<npatch; i++) n += 4 + lens[i];
+
+    p = jr.buf + jr.last;
+    if (jr.merge && npatch == 1 && p[0] == kind && p[1] == 1
+            && jr.last + n == jr.len && _same_patch(p + JR_HEADER, addrs[0], lens[0])) {
+        rep = get16(p+2);
+        dt = ticks - get64(p+8);
+        if (rep == 0 && dt <= 0xffffffff) {
+            put16(p+2, 1);
+            put32(p+4, (uint32_t)dt);
+            return;
+        }
+        if (rep && rep < 0xffff && dt == (uint64_t)(rep + 1) * get32(p+4)) {
+            put16(p+2, rep + 1);
+            return;
+        }
+    }
+
+    if (jr.len + n > jr.cap) {
+        jr.cap = jr.cap ? 2 * jr.cap : 0x10000;
+        if (jr.cap < jr.len + n) jr.cap = jr.len + n;
+        jr.buf = realloc(jr.buf, jr.cap);
+    }
+    p = jr.buf + jr.len;
+    p[0] = kind;
+    p[1] = npatch;
+    put16(p+2, 0);
+    put32(p+4, 0);
+    put64(p+8, ticks);
+    for (p += JR_HEADER, i=0; i<npatch; i++, p += 4 + lens[i-1]) {
+        put16(p, addrs[i]);
+        put16(p+2, lens[i]);
+        for (j=0; j<lens[i]; j++) p[4+j] = memory[(uint16_t)(addrs[i] + j)];
+    }
+    jr.last = jr.len;
+    jr.len += n;
+    jr.rec = jr.len;
+    jr.idx = 0;
+    jr.merge = 1;
+}
+
+
+int journal_replaying() {
+    return jr.rec < jr.len;
+}
+
+int journal_replay(int kind) {
+    /*
+    replay the next input event if we're behind the end of the journal,
+    returning its kind (JR_EOF can stand in for JR_GETC) or 0 if live
+    */
+    uint8_t *p, *q;
+    uint16_t addr, len;
+    int i, j, k;
+
+    if (jr.rec >= jr.len) return 0;
+
+    p = jr.buf + jr.rec;
+    k = p[0];
+    if (!(k == kind || (kind == JR_GETC && k == JR_EOF))
+            || ticks != get64(p+8) + (uint64_t)jr.idx * get32(p+4)) {
+        fprintf(stderr, "c65: input replay diverged at tick %" PRIu64 ", continuing live\n", ticks);
+        journal_truncate();
+        return 0;
+    }
+    for (q = p + JR_HEADER, i=0; i<p[1]; i++, q += 4 + len) {
+        addr = get16(q);
+        len = get16(q+2);
+        for (j=0; j<len; j++) memory[(uint16_t)(addr + j)] = q[4+j];
+        mark_dirty(addr, len);
+    }
+    if (jr.idx < get16(p+2)) {
+        jr.idx++;
+    } else {
+        jr.rec += _reclen(p);
+        jr.idx = 0;
+    }
+    return k;
+}
+
+
+uint64_t journal_tell() {
+    /* the next live event mustn't merge into a record before this position */
+    if (jr.rec == jr.len) jr.merge = 0;
+    return ((uint64_t)jr.rec << 16) | jr.idx;
+}
+
+void journal_seek(uint64_t pos) {
+    uint64_t off = pos >> 16;
+
+    jr.idx = pos & 0xffff;
+    if (off >= jr.len) {
+        jr.rec = jr.len;
+        jr.idx = 0;
+    } else {
+        jr.rec = off;
+        if (jr.idx > get16(jr.buf + jr.rec + 2)) {
+            /* past the repeats of a record that was truncated */
+            jr.rec += _reclen(jr.buf + jr.rec);
+            jr.idx = 0;
+        }
+    }
+    jr.merge = 0;
+}
+
+void journal_truncate() {
+    /* discard everything after the replay position and continue live */
+    uint8_t *p = jr.buf + jr.rec;
+
+    if (jr.rec < jr.len) {
+        if (jr.idx) {
+            put16(p+2, jr.idx - 1);
+            jr.len = jr.rec + _reclen(p);
+        } else {
+            jr.len = jr.rec;
+        }
+    }
+    jr.rec = jr.len;
+    jr.idx = 0;
+    jr.merge = 0;
+    /* output from here on is new, even if we'd already run further before stepping back */
+    io_replay_until = instructions;
+}
+
+void journal_clear() {
+    /* forget the records before the replay position, unless we're saving them */
+    if (journal_on & JOURNAL_RECORD) return;
+    memmove(jr.buf, jr.buf + jr.rec, jr.len - jr.rec);
+    jr.len -= jr.rec;
+    jr.rec = 0;
+    jr.merge = 0;
+}
+
+
+int journal_load(const char *fname) {
+    /* replay inputs from a journal file, recorded with journal_record_to */
+    FILE *fin;
+    long sz;
+    size_t off, n;
+    uint8_t hdr[8];
+
+    fin = fopen(fname, "rb");
+    if (!fin) {
+        fprintf(stderr, "File not found: %s\n", fname);
+        return -1;
+    }
+    fseek(fin, 0L, SEEK_END);
+    sz = ftell(fin) - sizeof(hdr);
+    rewind(fin);
+    if (sz < 0 || fread(hdr, 1, sizeof(hdr), fin) != sizeof(hdr)
+            || memcmp(hdr, JR_MAGIC, 4) || get16(hdr+4) != JR_VERSION) {
+        fprintf(stderr, "Not a c65 journal: %s\n", fname);
+        fclose(fin);
+        return -1;
+    }
+    free(jr.buf);
+    jr.buf = malloc(sz ? sz : 1);
+    jr.cap = sz;
+    jr.len = fread(jr.buf, 1, sz, fin);
+    fclose(fin);
+
+    /* check the records are complete, dropping any partial one at the end */
+    for (off=0; (n = _complete(jr.buf + off, jr.len - off)); off += n) /**/ ;
+    if (off != jr.len) fprintf(stderr, "c65: ignoring truncated record at the end of %s\n", fname);
+    jr.len = off;
+    jr.rec = jr.idx = 0;
+    jr.merge = 0;
+    return 0;
+}
+
+void journal_record_to(const char *fname) {
+    free(jr_fname);
+    jr_fname = strdup(fname);
+    journal_on |= JOURNAL_RECORD;
+}
+
+void journal_exit() {
+    /* save the journal, including any records we were replaying */
+    FILE *fout;
+    uint8_t hdr[8];
+
+    if (!jr_fname) return;
+    memcpy(hdr, JR_MAGIC, 4);
+    put16(hdr+4, JR_VERSION);
+    put16(hdr+6, 0);
+    fout = fopen(jr_fname, "wb");
+    if (!fout || fwrite(hdr, 1, sizeof(hdr), fout) != sizeof(hdr)
+            || fwrite(jr.buf, 1, jr.len, fout) != jr.len) {
+        fprintf(stderr, "Error writing %s\n", jr_fname);
+    } else if (!quiet) {
+        printf("c65: wrote input journal to %s\n", jr_fname);
+    }
+    if (fout) fclose(fout);
+}
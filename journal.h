@@ -0,0 +1,32 @@
+/*
+The input journal records each value that magic IO brings in from the host,
+like keyboard polls and block reads, so that a run can be replayed exactly.
+While the replay position is behind the end of the journal, magic IO takes
+its inputs from the journal and suppresses host side effects like output.
+*/
+
+#define JR_KBHIT 1
+#define JR_GETC 2
+#define JR_EOF 3        /* getc reached the end of input */
+#define JR_BLKIO 4
+#define JR_FILEIO 5
+#define JR_CLOCK 6       /* host microseconds */
+
+/* journal_on flags for the features that need the journal */
+#define JOURNAL_REVERSE 1
+#define JOURNAL_RECORD 2
+
+extern int journal_on;
+
+int journal_load(const char *fname);
+void journal_record_to(const char *fname);
+void journal_exit();
+
+void journal_record(int kind, int npatch, const uint16_t *addrs, const uint16_t *lens);
+int journal_replay(int kind);
+int journal_replaying();
+
+uint64_t journal_tell();
+void journal_seek(uint64_t pos);
+void journal_truncate();
+void journal_clear();
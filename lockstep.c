@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define FAKE6502_NOT_STATIC 1
+#define FAKE6502_INCLUDE 1
+#include "fake65c02.h"
+
+#include "lockstep.h"
+#include "altcore.h"
+#include "c65.h"
+#include "monitor.h"
+#include "magicio.h"
+
+/*
+Both engines step one instruction at a time.  The alternative engine
+reads the magic IO block from a copy taken before the reference step,
+so it sees the same inputs without repeating any host side effects,
+nor the reference's own writes, as with a read-modify-write like inc $f00f.
+Host writes to memory like block reads or getc are copied across via
+mark_dirty, into the IO copy as well.  Whenever we resume
+from the monitor, which might have changed anything, the alternative
+engine restarts from a full copy of the reference state.
+*/
+
+int lockstep_on = 0;
+
+static int stop_flag = MONITOR_EXIT;
+static int nwrites = 0;
+static uint16_t waddrs[ALT_MAX_WRITES];
+static uint8_t wvals[ALT_MAX_WRITES];
+static uint8_t io_before[IO_SIZE];
+
+
+void lockstep_enable(int stop) {
+    /* stop is the break_flag to set on divergence */
+    stop_flag = stop;
+    alt_io_memory = io_before;
+    lockstep_on = 1;
+    lockstep_sync();
+}
+
+void lockstep_sync() {
+    AltState s = { pc, a, x, y, sp, status, waiting6502 };
+
+    memcpy(alt_memory, memory, 0x10000);
+    alt_set(&s);
+}
+
+void lockstep_copy(uint16_t start, uint32_t len) {
+    /* copy host changes to memory, wrapping at the top of memory */
+    uint32_t part = 0x10000 - start;
+
+    if (len > 0x10000) len = 0x10000;
+    if (part > len) part = len;
+    memcpy(alt_memory + start, memory + start, part);
+    memcpy(alt_memory, memory, len - part);
+    for (part = 0; part < IO_SIZE; part++)
+        if ((uint16_t)(io_addr + part - start) < len) io_before[part] = memory[(uint16_t)(io_addr + part)];
+}
+
+void lockstep_write(uint16_t addr, uint8_t val) {
+    if (nwrites < ALT_MAX_WRITES) {
+        waddrs[nwrites] = addr;
+        wvals[nwrites] = val;
+    }
+    nwrites++;
+}
+
+
+static void _show(const char *name, const AltState *s, uint32_t dt, int n, const uint16_t *addrs, const uint8_t *vals) {
+    int i;
+
+    printf(
+        "%s PC=%04x A=%02x X=%02x Y=%02x S=%02x FLAGS=%02x%s ticks=+%u writes:",
+        name, s->pc, s->a, s->x, s->y, s->sp, s->status, s->waiting ? " (waiting)" : "", dt
+    );
+    for (i=0; i<n && i<ALT_MAX_WRITES; i++) printf(" %04x=%02x", addrs[i], vals[i]);
+    if (n > ALT_MAX_WRITES) printf(" ...");
+    if (!n) printf(" none");
+    putchar('\n');
+}
+
+uint32_t lockstep_step() {
+    AltState ref, alt;
+    uint16_t start = pc;
+    uint32_t dt, alt_dt;
+    int i;
+
+    nwrites = 0;
+    for (i = 0; i < IO_SIZE; i++) io_before[i] = memory[(uint16_t)(io_addr + i)];
+    dt = step6502();
+    alt_dt = alt_step();
+
+    alt_get(&alt);
+    ref.pc = pc;
+    ref.a = a;
+    ref.x = x;
+    ref.y = y;
+    ref.sp = sp;
+    ref.status = status;
+    ref.waiting = waiting6502;
+    if (!memcmp(&ref, &alt, sizeof(AltState)) && dt == alt_dt && nwrites == alt_nwrites
+            && !memcmp(waddrs, alt_waddrs, (nwrites < ALT_MAX_WRITES ? nwrites : ALT_MAX_WRITES) * sizeof(uint16_t))
+            && !memcmp(wvals, alt_wvals, nwrites < ALT_MAX_WRITES ? nwrites : ALT_MAX_WRITES))
+        return dt;
+
+    printf("\nc65: lockstep engines diverged at instruction %llu, tick %" PRIu64 "\n", instructions, ticks + dt);
+    disasm(start, start+1);
+    _show("reference", &ref, dt, nwrites, waddrs, wvals);
+    _show("alternate", &alt, alt_dt, alt_nwrites, alt_waddrs, alt_wvals);
+    if (stop_flag & MONITOR_EXIT) exit_code = 1;
+    break_flag |= stop_flag;
+    return dt;
+}
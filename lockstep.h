@@ -0,0 +1,13 @@
+/*
+Lockstep mode runs the alternative engine in altcore.c alongside the
+reference core, each with its own copy of memory, and stops at the first
+instruction where their registers, cycle counts or memory writes differ.
+*/
+
+extern int lockstep_on;
+
+void lockstep_enable(int stop);
+void lockstep_sync();
+void lockstep_copy(uint16_t start, uint32_t len);
+void lockstep_write(uint16_t addr, uint8_t val);
+uint32_t lockstep_step();
@@ -5,20 +5,35 @@
 // environments (Linux, OSX, WSL, Native Windows) that all have gcc.
 #ifdef WINDOWS_NATIVE
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include <conio.h> // Windows specific
 
 void set_terminal_nb() {} // No-op
 //int _kbhit(); // _kbhit already available in conio.h
 int _getc() { return getch(); } // getch() from conio.h has no echo.
 void _putc(char ch) { putchar(ch); fflush(stdout); return; }
+
+uint64_t _usecs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Only the checks on the name itself apply, since symlinks are rare here
+int _inside(const char *dir, const char *path) { return 1; }
 #else
 // These should work on Linux, OSX, and WSL.
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <sys/select.h>
 #include <termios.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 struct termios orig_termios;
 
@@ -67,16 +82,46 @@ int _getc() {
   int r;
   unsigned char c;
   r = read(0, &c, sizeof(c));
-  return r < 0 ? r : c;
+  return r == 1 ? c : EOF;
 }
 
 void _putc(char ch) { putchar((int)ch); }
+
+/* monotonic host clock in microseconds */
+uint64_t _usecs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int _inside(const char *dir, const char *path) {
+  // Check that path stays inside dir after following symlinks.
+  // A new file must be in a directory inside dir, and not be a dangling link.
+  char base[PATH_MAX], real[PATH_MAX], parent[PATH_MAX], *p;
+  struct stat st;
+  size_t n;
+
+  if (!realpath(dir, base)) return 0;
+  n = strlen(base);
+  if (realpath(path, real)) return !strncmp(real, base, n) && real[n] == '/';
+  if (!lstat(path, &st) || strlen(path) >= sizeof(parent)) return 0;
+  strcpy(parent, path);
+  if (!(p = strrchr(parent, '/'))) return 0;
+  *p = 0;
+  if (!realpath(parent, real)) return 0;
+  return !strncmp(real, base, n) && (real[n] == '/' || !real[n]);
+}
 #endif
 
 #include <signal.h>
-#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include "magicio.h"
+#include "blkfile.h"
+#include "journal.h"
 #include "c65.h"
+#include "regions.h"
 
 /*
 blkio supports the following action values.  write the action value
@@ -87,24 +132,112 @@ and check if status is now 0.
     0 - status: detect if blkio available, 0x0 if enabled, 0xff otherwise
     1 - read: read the 1024 byte block @ blknum to bufptr
     2 - write: write the 1024 byte block @ blknum from bufptr
+    3 - read32: like read but using the 32-bit block number blknum_hi:blknum
+    4 - write32: like write but using the 32-bit block number blknum_hi:blknum
+The extended blknum_hi field is only consulted by actions 3 and 4
+so existing guests which never set it are unaffected.
 */
 typedef struct BLKIO {
   uint8_t action;  // I: request an action (write after setting other params)
   uint8_t status;  // O: action status
   uint16_t blknum; // I: block to read or write
   uint16_t bufptr; // I/O: low-endian pointer to 1024 byte buffer to read/write
+  uint16_t blknum_hi; // I: high word of block number for read32/write32
 } BLKIO;
 
-BLKIO *blkiop;
-FILE *fblk = NULL;
+unsigned long long io_replay_until = 0;
+
+BlkFile *fblk = NULL;
+BlkStats blkstats;
+int io_host_times = 1;      /* show host times in statistics, off for reproducible output */
+IoCounts iocounts;
+
+/*
+fileio streams named host files directly to and from memory, so the guest
+can load source files without packing them into a block image.  Like blkio,
+set the other parameters and then write the action value.  All actions
+return 0x0 on success and 0xff otherwise.
+    0 - status: detect if fileio available, 0x0 if enabled (see -f)
+Without -f nothing is intercepted, so a status check leaves status unchanged.
+    1 - open: open the zero-terminated filename @ bufptr to read, setting handle
+    2 - create: create or truncate the filename @ bufptr to write, setting handle
+    3 - read: read up to length bytes from handle to bufptr, setting length to
+        the number of bytes actually read, which is 0 at end of file
+    4 - write: write length bytes from bufptr to handle
+    5 - seek: set the position of handle to offset
+    6 - close: close handle
+read, write and seek also set offset to the resulting file position.
+Filenames are relative to the -f directory and may not contain "..".
+*/
+typedef struct FILEIO {
+  uint8_t action;   // I: request an action (write after setting other params)
+  uint8_t status;   // O: action status
+  uint8_t handle;   // I/O: file handle, returned by open or create
+  uint8_t reserved;
+  uint16_t bufptr;  // I: filename for open/create, otherwise data buffer
+  uint16_t length;  // I/O: bytes to read/write, returns bytes transferred
+  uint32_t offset;  // I/O: file position for seek, returns current position
+} FILEIO;
+
+#define FILEIO_MAX 8
+
+FILE *files[FILEIO_MAX];
+char *filedir = NULL;
+
+/*
+With -i, console input is read from a file on virtual time rather than
+from the terminal.  Each character becomes ready input_delay ticks after
+the previous one was read, and polling never sleeps, so cycle counts are
+repeatable.  Newlines are sent as CR, like the Enter key in a terminal.
+*/
+FILE *input = NULL;
+uint64_t input_delay = 0, input_ready = 0;
+
 int io_addr = 0xf000;
 long mark = 0;    // used for timer
 
+/*
+The original block left $0c-$0f unused, so guests may keep their own data
+there.  --guest-ctl makes them control registers, for the exit status
+and profiling regions.
+*/
+int io_guest_ctl = 0;
+
+/*
+Besides the original timer, --timers adds a separate block with eight
+independent timers with 64-bit counts.  It's off unless asked for, since
+guests that only know the original block may use the memory after it.
+Write $10+n to the timer register to start timer n, $20+n to stop it,
+$30+n to reset it to zero, or $40+n to latch its count, including the current
+run if it's going, into the count register.  Reading the low byte of the
+instruction or microsecond register latches all eight bytes.  Host time
+isn't deterministic, so it goes through the journal like other inputs.
+*/
+int io_taddr = -1;    /* base of the timer block, or -1 for none */
+IoTimer io_timers[IO_TIMERS];
+static uint64_t start_usecs = 0;
+
 #define io_putc   (io_addr + 1)
 #define io_kbhit  (io_addr + 3)
 #define io_getc   (io_addr + 4)
 #define io_timer  (io_addr + 6)
+/* the control registers are only live with --guest-ctl, otherwise they're -1 */
+#define io_ctl(n) (io_guest_ctl ? io_addr + (n) : -1)
+#define io_exitc  io_ctl(12)
+#define io_region io_ctl(13)
+#define io_regprof io_ctl(14)
 #define io_blkio  (io_addr + 16)
+#define io_fileio (io_addr + 32)
+/* without a timer block these are -1, which no address matches */
+#define io_tblock(n) (io_taddr < 0 ? -1 : io_taddr + (n))
+#define io_tctl   io_tblock(0)
+#define io_tcount io_tblock(8)
+#define io_instrs io_tblock(16)
+#define io_usecs  io_tblock(24)
+
+/* the interface structs move with io_addr, e.g. after loading a snapshot */
+#define blkiop    ((BLKIO *)(memory + io_blkio))
+#define fileiop   ((FILEIO *)(memory + io_fileio))
 
 
 void sigint_handler() {
@@ -114,34 +247,199 @@ void sigint_handler() {
 }
 
 void io_init(int debug) {
-  /* initialize blkio struct once io_addr is set */
-  blkiop = (BLKIO *)(memory + io_blkio);
+  start_usecs = _usecs();
   set_terminal_nb();
   if (debug) signal(SIGINT, sigint_handler);
 }
 
 void io_exit() {
-    io_blkfile(NULL);
+  int i;
+
+  if (!quiet && blkstats.reads + blkstats.writes) io_blkstats_print(8);
+  io_blkfile(NULL);
+  for (i=0; i<FILEIO_MAX; i++)
+    if (files[i]) fclose(files[i]);
+  if (input) fclose(input);
+  journal_exit();
+}
+
+
+int io_input(const char *fname, uint64_t delay) {
+  if (input) fclose(input);
+  input = fopen(fname, "rb");
+  if (!input) {
+    fprintf(stderr, "File not found: %s\n", fname);
+    return -1;
+  }
+  input_delay = delay;
+  input_ready = 0;
+  return 0;
 }
 
+static int _con_ready() {
+  /* at the end of input we stay ready so the guest's getc sees EOF */
+  int ready;
 
-FILE* io_blkfile(const char *fname) {
-  if (fblk) fclose(fblk);
-  if (fname) fblk = fopen(fname, "r+b");
-  return fblk;
+  if (input) return ticks >= input_ready;
+  ready = _kbhit();
+  /* a guest waiting for a key barely advances ticks, so check the clock now */
+  if (!ready) check_limits();
+  return ready;
+}
+
+static int _con_getc() {
+  int ch;
+
+  if (!input) return _getc();
+  ch = fgetc(input);
+  input_ready = ticks + input_delay;
+  return ch == '\n' ? '\r' : ch;
+}
+
+
+void io_filedir(const char *dir) {
+  free(filedir);
+  filedir = dir ? strdup(dir) : NULL;
+}
+
+
+int io_blkfile(const char *fname) {
+  if (fblk) blk_close(fblk);
+  fblk = fname ? blk_open(fname) : NULL;
+
+  /* statistics are kept per block file */
+  free(blkstats.fname);
+  free(blkstats.hits);
+  memset(&blkstats, 0, sizeof(blkstats));
+  if (fblk) blkstats.fname = strdup(fname);
+
+  return fname && !fblk ? -1 : 0;
+}
+
+
+uint64_t io_blkcount() {
+  return fblk ? blk_count(fblk) : 0;
+}
+
+
+static void _blkstats_hit(uint32_t blknum, int write) {
+  BlkHits *h;
+  uint32_t lo = 0, hi = blkstats.n, mid;
+
+  /* binary search for the block, inserting a new entry if needed */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (blkstats.hits[mid].blknum < blknum) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == blkstats.n || blkstats.hits[lo].blknum != blknum) {
+    if (blkstats.n == blkstats.cap) {
+      blkstats.cap = blkstats.cap ? 2 * blkstats.cap : 64;
+      blkstats.hits = realloc(blkstats.hits, blkstats.cap * sizeof(BlkHits));
+    }
+    memmove(blkstats.hits + lo + 1, blkstats.hits + lo, (blkstats.n - lo) * sizeof(BlkHits));
+    blkstats.n++;
+    memset(blkstats.hits + lo, 0, sizeof(BlkHits));
+    blkstats.hits[lo].blknum = blknum;
+  }
+  h = blkstats.hits + lo;
+  if (write) h->writes++;
+  else h->reads++;
+}
+
+
+static int _cmp_hits(const void *p, const void *q) {
+  const BlkHits *a = p, *b = q;
+  uint64_t na = a->reads + a->writes, nb = b->reads + b->writes;
+  return na < nb ? 1 : (na > nb ? -1 : (a->blknum > b->blknum) - (a->blknum < b->blknum));
+}
+
+void io_blkstats_print(int top) {
+  BlkHits *sorted;
+  uint64_t ops = blkstats.reads + blkstats.writes;
+  uint32_t i;
+
+  if (!blkstats.fname) {
+    puts("No block file");
+    return;
+  }
+  printf(
+    "blkio %s: %" PRIu64 " reads, %" PRIu64 " writes, %" PRIu64 " errors, %" PRIu64 " bytes\n",
+    blkstats.fname, blkstats.reads, blkstats.writes, blkstats.errors, blkstats.bytes
+  );
+  if (io_host_times) printf(
+    "blkio host time %.3f ms (%.1f us/op), ",
+    blkstats.usecs / 1000.0, ops ? (double)blkstats.usecs / ops : 0.0
+  );
+  printf("%u distinct block%s\n", blkstats.n, blkstats.n == 1 ? "" : "s");
+  if (!top || !blkstats.n) return;
+
+  sorted = malloc(blkstats.n * sizeof(BlkHits));
+  memcpy(sorted, blkstats.hits, blkstats.n * sizeof(BlkHits));
+  qsort(sorted, blkstats.n, sizeof(BlkHits), _cmp_hits);
+  puts("     block      reads     writes");
+  for (i=0; i<blkstats.n && i<top; i++)
+    printf("%10u %10" PRIu64 " %10" PRIu64 "\n", sorted[i].blknum, sorted[i].reads, sorted[i].writes);
+  if (blkstats.n > top) puts("...");
+  free(sorted);
+}
+
+
+static void _put64(uint16_t addr, uint64_t v) {
+  /* little-endian, wrapping at the top of memory */
+  int i;
+
+  for (i=0; i<8; i++, v >>= 8) memory[(uint16_t)(addr + i)] = v & 0xff;
+  mark_dirty(addr, 8);
+}
+
+static void _timer_action(uint8_t val) {
+  IoTimer *t;
+
+  if ((val & 0x0f) >= IO_TIMERS) return;
+  t = io_timers + (val & 0x0f);
+  switch (val >> 4) {
+    case 1: /* start */
+      if (!t->running) t->start = ticks;
+      t->running = 1;
+      break;
+    case 2: /* stop */
+      if (t->running) t->count += ticks - t->start;
+      t->running = 0;
+      break;
+    case 3: /* reset */
+      t->count = 0;
+      t->start = ticks;
+      break;
+    case 4: /* latch */
+      _put64(io_tcount, t->count + (t->running ? ticks - t->start : 0));
+      break;
+  }
 }
 
 
 void io_magic_read(uint16_t addr) {
+  const uint16_t one = 1, eight = 8;
   int ch;
   long delta;
 
   if (addr == io_kbhit) {
-    memory[addr] = _kbhit() ? 0xff : 0;
+    iocounts.kbhit++;
+    if (journal_replay(JR_KBHIT)) return;
+    memory[addr] = _con_ready() ? 0xff : 0;
+    mark_dirty(addr, 1);
+    journal_record(JR_KBHIT, 1, &addr, &one);
   } else if (addr == io_getc) {
-    ch = break_flag ? 0x03 : (_kbhit() ? _getc() : 0);
+    iocounts.getc++;
+    if ((ch = journal_replay(JR_GETC))) {
+      if (ch == JR_EOF) break_flag |= MONITOR_EXIT;
+      return;
+    }
+    ch = break_flag ? 0x03 : (_con_ready() ? _con_getc() : 0);
     if (ch == EOF) break_flag |= MONITOR_EXIT;
     memory[addr] = (uint8_t)ch;
+    mark_dirty(addr, 1);
+    journal_record(ch == EOF ? JR_EOF : JR_GETC, 1, &addr, &one);
   } else if (addr == io_timer /* start timer */) {
     mark = ticks;
   } else if (addr == io_timer + 1 /* stop timer */) {
@@ -150,29 +448,152 @@ void io_magic_read(uint16_t addr) {
     memory[io_timer + 3] = (uint8_t)((delta >> 24) & 0xff);
     memory[io_timer + 4] = (uint8_t)((delta >> 0) & 0xff);
     memory[io_timer + 5] = (uint8_t)((delta >> 8) & 0xff);
+    mark_dirty(io_timer + 2, 4);
+  } else if (addr == io_instrs) {
+    _put64(io_instrs, instructions);
+  } else if (addr == io_usecs) {
+    if (journal_replay(JR_CLOCK)) return;
+    _put64(io_usecs, _usecs() - start_usecs);
+    journal_record(JR_CLOCK, 1, &addr, &eight);
+  }
+}
+
+
+void io_blkio_action(uint8_t action) {
+  uint8_t buf[BLK_SIZE];
+  uint32_t blknum;
+  uint64_t t;
+  int i, err;
+
+  blknum = blkiop->blknum;
+  if (action == 3 || action == 4) {
+    blknum |= (uint32_t)blkiop->blknum_hi << 16;
+    action -= 2;
+  }
+  if (action == 1 || action == 2) {
+    t = _usecs();
+    /* the buffer wraps at the top of memory like any other 6502 access */
+    for (i=0; i<BLK_SIZE; i++) buf[i] = memory[(uint16_t)(blkiop->bufptr + i)];
+    if (action == 1) {
+      err = blk_read(fblk, blknum, buf);
+      for (i=0; i<BLK_SIZE; i++) memory[(uint16_t)(blkiop->bufptr + i)] = buf[i];
+      mark_dirty(blkiop->bufptr, BLK_SIZE);
+      blkstats.reads++;
+      iocounts.blkreads++;
+    } else {
+      err = blk_write(fblk, blknum, buf);
+      blkstats.writes++;
+      iocounts.blkwrites++;
+    }
+    blkstats.usecs += _usecs() - t;
+    if (err) {
+      blkstats.errors++;
+      iocounts.blkerrors++;
+    }
+    else blkstats.bytes += BLK_SIZE;
+    _blkstats_hit(blknum, action == 2);
+  } else {
+    err = action != 0;
   }
+  blkiop->status = err ? 0xff : 0;
+}
+
+static size_t _file_transfer(FILE *f, uint16_t start, uint16_t length, int write) {
+  /* move bytes directly between memory and f, wrapping at the top of memory */
+  size_t n, k = 0;
+  uint32_t part = 0x10000 - start;
+
+  if (part > length) part = length;
+  n = write ? fwrite(memory + start, 1, part, f) : fread(memory + start, 1, part, f);
+  if (n == part && part < length)
+    k = write ? fwrite(memory, 1, length - part, f) : fread(memory, 1, length - part, f);
+  return n + k;
 }
 
+void io_fileio_action(uint8_t action) {
+  char fname[256], path[1024];
+  FILE *f;
+  int i, h = fileiop->handle - 1;
+
+  if (action == 1 || action == 2) {
+    for (i=0; i<sizeof(fname)-1 && memory[(uint16_t)(fileiop->bufptr + i)]; i++)
+      fname[i] = memory[(uint16_t)(fileiop->bufptr + i)];
+    fname[i] = 0;
+    /* stay inside filedir, so no absolute paths, drive letters, .. or symlinks out */
+    if (!i || fname[0] == '/' || fname[0] == '\\' || strchr(fname, ':') || strstr(fname, "..")) return;
+    for (h=0; h<FILEIO_MAX && files[h]; h++) /**/ ;
+    if (h == FILEIO_MAX) return;
+    snprintf(path, sizeof(path), "%s/%s", filedir, fname);
+    if (!_inside(filedir, path)) return;
+    if (!(files[h] = fopen(path, action == 1 ? "rb" : "w+b"))) return;
+    fileiop->handle = h + 1;
+    fileiop->offset = 0;
+  } else if (action) {
+    if (h < 0 || h >= FILEIO_MAX || !(f = files[h])) return;
+    switch (action) {
+      case 3:
+        fileiop->length = (uint16_t)_file_transfer(f, fileiop->bufptr, fileiop->length, 0);
+        mark_dirty(fileiop->bufptr, fileiop->length);
+        if (ferror(f)) return;
+        break;
+      case 4:
+        if (_file_transfer(f, fileiop->bufptr, fileiop->length, 1) != fileiop->length) return;
+        fflush(f);
+        break;
+      case 5:
+        if (fseek(f, fileiop->offset, SEEK_SET)) return;
+        break;
+      case 6:
+        fclose(f);
+        files[h] = NULL;
+        break;
+      default:
+        return;
+    }
+    if (files[h]) fileiop->offset = (uint32_t)ftell(f);
+  }
+  fileiop->status = 0;
+}
 
 void io_magic_write(uint16_t addr, uint8_t val) {
+  /* input events record the struct, plus any buffer that was read into */
+  uint16_t addrs[2] = {addr, 0}, lens[2] = {0, 0};
+
   if (addr == io_putc) {
-    _putc(val);
+    iocounts.putc++;
+    /* don't repeat output when replaying history after reverse steps */
+    if (instructions >= io_replay_until) _putc(val);
+  } else if (addr == io_exitc) {
+    exit_code = val;
+    break_flag |= MONITOR_EXIT;
+  } else if (addr == io_region) {
+    /* like output, regions were already counted if we're replaying history */
+    if (instructions < io_replay_until) return;
+    if (val) regions_enter(val);
+    else regions_leave();
+  } else if (addr == io_regprof) {
+    regions_profile(val);
+  } else if (addr == io_tctl) {
+    _timer_action(val);
   } else if (addr == io_blkio) {
+    if (journal_replay(JR_BLKIO)) return;
     blkiop->status = 0xff;
-    if (fblk) {
-      if (val < 3) {
-        blkiop->status = 0;
-        if (val == 1 || val == 2) {
-          fseek(fblk, 1024 * blkiop->blknum, SEEK_SET);
-          if (val == 1) {
-            fread(memory + blkiop->bufptr, 1024, 1, fblk);
-          } else {
-            fwrite(memory + blkiop->bufptr, 1024, 1, fblk);
-            fflush(fblk);
-          }
-        }
-      }
-    }
+    if (fblk) io_blkio_action(val);
+    mark_dirty(io_blkio, sizeof(BLKIO));
+    lens[0] = sizeof(BLKIO);
+    addrs[1] = blkiop->bufptr;
+    lens[1] = BLK_SIZE;
+    journal_record(JR_BLKIO, (val == 1 || val == 3) ? 2 : 1, addrs, lens);
+  } else if (addr == io_fileio && filedir) {
+    /* without -f these bytes are plain memory, since they're beyond the original block */
+    if (journal_replay(JR_FILEIO)) return;
+    fileiop->status = 0xff;
+    io_fileio_action(val);
+    mark_dirty(io_fileio, sizeof(FILEIO));
+    lens[0] = sizeof(FILEIO);
+    addrs[1] = fileiop->bufptr;
+    lens[1] = fileiop->length;
+    journal_record(JR_FILEIO, val == 3 && !fileiop->status ? 2 : 1, addrs, lens);
   }
 }
 
@@ -1,8 +1,52 @@
+/* per block file statistics for blkio, see io_blkfile */
+typedef struct BlkHits {
+  uint32_t blknum;
+  uint64_t reads, writes;
+} BlkHits;
+
+typedef struct BlkStats {
+  char *fname;
+  uint64_t reads, writes, errors, bytes;
+  uint64_t usecs;       /* host time spent in block IO */
+  uint32_t n, cap;      /* hit counts for distinct blocks, sorted by blknum */
+  BlkHits *hits;
+} BlkStats;
+
+/* how often the guest used the console and block IO over the whole run, see --stats */
+typedef struct IoCounts {
+  uint64_t putc, getc, kbhit;
+  uint64_t blkreads, blkwrites, blkerrors;   /* unlike blkstats, across all block files */
+} IoCounts;
+
+/* independent guest timers, see io_timers in magicio.c */
+typedef struct IoTimer {
+  uint64_t count, start;
+  int running;
+} IoTimer;
+
+#define IO_TIMERS 8
+#define IO_SIZE 44      /* bytes in the magic IO block from io_addr */
+#define IO_TSIZE 32     /* bytes in the optional timer block from io_taddr */
+
 extern int io_addr;
+extern int io_taddr;
+extern int io_guest_ctl;
+extern int io_host_times;
+extern long mark;
+extern IoTimer io_timers[IO_TIMERS];
+extern unsigned long long io_replay_until;
+extern BlkStats blkstats;
+extern IoCounts iocounts;
 
 void io_init(int debug);
 void io_exit();
 
-FILE* io_blkfile(const char *fname);
+uint64_t _usecs();
+
+int io_blkfile(const char *fname);
+uint64_t io_blkcount();
+void io_filedir(const char *dir);
+int io_input(const char *fname, uint64_t delay);
+void io_blkstats_print(int top);
 void io_magic_read(uint16_t addr);
 void io_magic_write(uint16_t addr, uint8_t);
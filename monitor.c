@@ -13,6 +13,11 @@
 #include "parse.h"
 #include "c65.h"
 #include "magicio.h"
+#include "blkfile.h"
+#include "snapshot.h"
+#include "reverse.h"
+#include "profile.h"
+#include "regions.h"
 #include "linenoise.h"
 
 
@@ -29,13 +34,27 @@ int org = -1;       /* the current address, reset to PC after each simulation st
 
 char _prompt[512];
 
-#define TXT_LO "\x1b[34m"
-#define TXT_B1 "\x1b[41m"
-#define TXT_B2 "\x1b[42m"
-#define TXT_B3 "\x1b[44m"
-#define TXT_N  "\x1b[0m"
+/* ANSI colors, which are switched off in headless mode */
+static const char *_txt_ansi[] = { "\x1b[34m", "\x1b[41m", "\x1b[42m", "\x1b[44m", "\x1b[0m" },
+    *_txt_none[] = { "", "", "", "", "" }, **_txt = _txt_ansi;
 
-#define FLAG_FMT(f, ch) (status & FLAG_##f ? TXT_B3 : TXT_LO), (status & FLAG_##f ? ch: tolower(ch))
+#define TXT_LO (_txt[0])
+#define TXT_B1 (_txt[1])
+#define TXT_B2 (_txt[2])
+#define TXT_B3 (_txt[3])
+#define TXT_N  (_txt[4])
+
+int monitor_errors = 0;     /* count of failed commands */
+int monitor_exit_on_error = 0;
+
+/* commands for headless mode, see monitor_script */
+static char **_script = NULL;
+static int _script_len = 0, _script_pos = 0, _failed = 0;
+
+static void _error(const char *msg) {
+    puts(msg);
+    monitor_errors++;
+}
 
 const char* _monitor_names[] = {
     "read", "write", "data", "execute", "x", 0
@@ -45,18 +64,29 @@ const int _monitor_vals[] = {
     MONITOR_READ, MONITOR_WRITE, MONITOR_DATA, MONITOR_PC, MONITOR_PC
 };
 
+/* heatmaps can also show cycles spent by opcode address */
+#define HEAT_CYCLES 128
+
+const char* _heat_names[] = {
+    "read", "write", "data", "execute", "x", "cycles", 0
+};
+
+const int _heat_vals[] = {
+    MONITOR_READ, MONITOR_WRITE, MONITOR_DATA, MONITOR_PC, MONITOR_PC, HEAT_CYCLES
+};
+
 char* prompt() {
-    sprintf(_prompt,
-        TXT_LO "PC" TXT_N " %.4x  "
-        "%s%c" TXT_N "%s%c" TXT_N TXT_LO "-" TXT_N "%s%c" TXT_N
-        "%s%c" TXT_N "%s%c" TXT_N "%s%c" TXT_N "%s%c" TXT_N "  "
-        TXT_LO "A " TXT_N "%.2x " TXT_LO "X " TXT_N "%.2x " TXT_LO "Y " TXT_N "%.2x " TXT_LO "SP " TXT_N "%.2x "
-        TXT_LO "> " TXT_N,
-        pc,
-        FLAG_FMT(SIGN, 'N'), FLAG_FMT(OVERFLOW, 'V'), /* - */ FLAG_FMT(BREAK, 'B'),
-        FLAG_FMT(DECIMAL, 'D'), FLAG_FMT(INTERRUPT, 'I'), FLAG_FMT(ZERO, 'Z'), FLAG_FMT(CARRY, 'C'),
-        a, x, y, sp
-    );
+    const char *flags = "NV-BDIZC";
+    char *p = _prompt;
+    int i, on;
+
+    p += sprintf(p, "%sPC%s %.4x  ", TXT_LO, TXT_N, pc);
+    for (i=0; i<8; i++) {
+        on = flags[i] != '-' && (status & (0x80 >> i));
+        p += sprintf(p, "%s%c%s", on ? TXT_B3 : TXT_LO, on ? flags[i] : tolower(flags[i]), TXT_N);
+    }
+    sprintf(p, "  %sA %s%.2x %sX %s%.2x %sY %s%.2x %sSP %s%.2x %s> %s",
+        TXT_LO, TXT_N, a, TXT_LO, TXT_N, x, TXT_LO, TXT_N, y, TXT_LO, TXT_N, sp, TXT_LO, TXT_N);
     return _prompt;
 }
 
@@ -83,20 +113,151 @@ char* heatstr(uint64_t d) {
             c = 1 + (bitlen(d) - 1) / heat_scale;
             if (c > 7) c = 7;
         }
-        sprintf(_heatbuf, "\x1b[%dm%c\x1b[0m", heat_colors[c], heat_ascii[c]);
+        if (_txt == _txt_none) sprintf(_heatbuf, "%c", heat_ascii[c]);
+        else sprintf(_heatbuf, "\x1b[%dm%c\x1b[0m", heat_colors[c], heat_ascii[c]);
     }
     return _heatbuf;
 }
 
+/*
+A heatmap recording follows how the read, write and execute counts change
+over time, say between the boot, compile and run phases of a program.
+Every `every` ticks we append a frame with the change in each count since
+the last frame.  Most addresses don't change, so a frame stores only the
+non-zero deltas, with each address as the gap from the previous one.
+All numbers are unsigned LEB128 varints, seven bits per byte, low first:
+
+    ticks               tick count at the end of the frame
+    n                   number of changed reads, followed by n pairs of
+      gap, delta          address minus (previous address + 1), and the change
+    n, ...              the same for writes
+    n, ...              and for executes
+
+after a header with the magic "C65H", a format version (2 bytes, little-endian)
+and two reserved bytes.  We also write a frame before clearing counts, and
+when recording stops, so the frames always add up to the activity since the start.
+Reverse steps and snapshots can set the ticks back, so a frame's ticks can be
+less than the one before, but the counts only ever grow.
+*/
+
+#define HR_MAGIC "C65H"
+#define HR_VERSION 1
+
+uint64_t heat_record_due = UINT64_MAX;
+
+static FILE *hr_file = NULL;
+static char *hr_fname = NULL;
+static uint64_t hr_every = 0, hr_ticks = 0, hr_frames = 0, hr_bytes = 0;
+static uint64_t *hr_last = NULL;   /* the counts at the last frame, 3 x 64K */
+
+static void _put_varint(uint8_t **p, uint64_t v) {
+    while (v >= 0x80) {
+        *(*p)++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *(*p)++ = v;
+}
+
+void heat_record() {
+    /* append the change in counts since the last frame */
+    uint64_t *counts[] = { heat_rs, heat_ws, heat_xs }, *last;
+    /* at worst a ten byte varint for the ticks, then for each count a three byte n and 64K entries */
+    static uint8_t buf[10 + 3 * 3 + 3 * 0x10000 * 13], ent[0x10000 * 13];
+    uint8_t *p = buf, *q;
+    int k, addr, prev, n;
+
+    if (!hr_file) return;
+    heat_record_due = ticks + hr_every;
+    _put_varint(&p, ticks);
+    for (k=0; k<3; k++) {
+        last = hr_last + k * 0x10000;
+        for (addr=0, prev=-1, n=0, q=ent; addr<0x10000; addr++) {
+            if (counts[k][addr] == last[addr]) continue;
+            _put_varint(&q, addr - prev - 1);
+            _put_varint(&q, counts[k][addr] - last[addr]);
+            last[addr] = counts[k][addr];
+            prev = addr;
+            n++;
+        }
+        _put_varint(&p, n);
+        memcpy(p, ent, q - ent);
+        p += q - ent;
+    }
+    if (fwrite(buf, 1, p - buf, hr_file) != (size_t)(p - buf) || fflush(hr_file)) {
+        fprintf(stderr, "Error writing %s, heatmap recording stopped\n", hr_fname);
+        fclose(hr_file);
+        hr_file = NULL;
+        heat_record_due = UINT64_MAX;
+        return;
+    }
+    hr_ticks = ticks;
+    hr_frames++;
+    hr_bytes += p - buf;
+}
+
+void heat_record_stop() {
+    if (!hr_file) return;
+    if (ticks != hr_ticks) heat_record();
+    if (!hr_file) return;
+    fclose(hr_file);
+    hr_file = NULL;
+    heat_record_due = UINT64_MAX;
+    printf("Recorded %" PRIu64 " heatmap frame%s (%" PRIu64 " bytes) to %s\n",
+        hr_frames, hr_frames == 1 ? "" : "s", hr_bytes, hr_fname);
+}
+
+void heat_record_rewind(uint64_t to) {
+    /* ticks are about to go back, so finish the frame so far and schedule the next from there */
+    if (!hr_file) return;
+    if (ticks != hr_ticks) heat_record();
+    if (!hr_file) return;
+    hr_ticks = to;
+    heat_record_due = to + hr_every;
+}
+
+int heat_record_start(const char *fname, uint64_t every) {
+    uint8_t hdr[8] = HR_MAGIC;
+
+    heat_record_stop();
+    hr_file = fopen(fname, "wb");
+    if (!hr_file) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        return -1;
+    }
+    hdr[4] = HR_VERSION & 0xff;
+    hdr[5] = HR_VERSION >> 8;
+    fwrite(hdr, 1, sizeof(hdr), hr_file);
+    free(hr_fname);
+    hr_fname = strdup(fname);
+    if (!hr_last) hr_last = malloc(3 * 0x10000 * sizeof(uint64_t));
+    /* deltas are relative to the counts so far */
+    memcpy(hr_last, heat_rs, 0x10000 * sizeof(uint64_t));
+    memcpy(hr_last + 0x10000, heat_ws, 0x10000 * sizeof(uint64_t));
+    memcpy(hr_last + 0x20000, heat_xs, 0x10000 * sizeof(uint64_t));
+    hr_every = every;
+    hr_ticks = ticks;
+    hr_frames = 0;
+    hr_bytes = sizeof(hdr);
+    heat_record_due = ticks + every;
+    return 0;
+}
+
 void clear_heatmap(uint16_t start, uint16_t end, int mode) {
     heat_scale = 0;
     int addr, endl;
 
+    if (hr_file && ticks != hr_ticks) heat_record();
     endl = end > start ? end : 0x10000;
     for(addr=start; addr<endl; addr++) {
         if (mode & MONITOR_READ) heat_rs[addr] = 0;
         if (mode & MONITOR_WRITE) heat_ws[addr] = 0;
         if (mode & MONITOR_PC) heat_xs[addr] = 0;
+        if (mode & HEAT_CYCLES) heat_cs[addr] = 0;
+        if (hr_last) {
+            hr_last[addr] = heat_rs[addr];
+            hr_last[addr + 0x10000] = heat_ws[addr];
+            hr_last[addr + 0x20000] = heat_xs[addr];
+        }
     }
 }
 
@@ -111,6 +272,7 @@ int save_heatmap(const char* fname, uint16_t start, uint16_t end, int mode) {
         if (mode & MONITOR_READ) d += heat_rs[addr];
         if (mode & MONITOR_WRITE) d += heat_ws[addr];
         if (mode & MONITOR_PC) d += heat_xs[addr];
+        if (mode & HEAT_CYCLES) d += heat_cs[addr];
         data[addr] = d;
     }
 
@@ -125,6 +287,15 @@ int save_heatmap(const char* fname, uint16_t start, uint16_t end, int mode) {
     return 0;
 }
 
+static void _heat_record_show() {
+    if (!hr_file) {
+        puts("Heatmap recording is off");
+        return;
+    }
+    printf("Recording heatmap every %" PRIu64 " ticks to %s, %" PRIu64 " frame%s (%" PRIu64 " bytes) so far\n",
+        hr_every, hr_fname, hr_frames, hr_frames == 1 ? "" : "s", hr_bytes);
+}
+
 void heatmap(uint16_t start, uint16_t end, int mode) {
     uint64_t data[1024], dmax, d;
     int i, zoom, addr, endl;
@@ -147,6 +318,7 @@ void heatmap(uint16_t start, uint16_t end, int mode) {
         if (mode & MONITOR_READ && data[i] < heat_rs[addr]) data[i] = heat_rs[addr];
         if (mode & MONITOR_WRITE && data[i] < heat_ws[addr]) data[i] = heat_ws[addr];
         if (mode & MONITOR_PC && data[i] < heat_xs[addr]) data[i] = heat_xs[addr];
+        if (mode & HEAT_CYCLES && data[i] < heat_cs[addr]) data[i] = heat_cs[addr];
     }
     /*
     set up a log color scale by picking a number of bits for each bucket
@@ -180,7 +352,8 @@ void heatmap(uint16_t start, uint16_t end, int mode) {
         if ((i & 0x3f) == 0x3f) puts("");
     }
     /* add a legend */
-    printf("\n%c%c%c count 0",
+    if (mode & HEAT_CYCLES) printf("\ncycles 0");
+    else printf("\n%c%c%c count 0",
         mode & MONITOR_READ ? 'r':'-',
         mode & MONITOR_WRITE ? 'w':'-',
         mode & MONITOR_PC ? 'x':'-'
@@ -192,6 +365,52 @@ void heatmap(uint16_t start, uint16_t end, int mode) {
     printf(" ($%x byte%s/char)\n\n", 1 << zoom, zoom ? "s": "");
 }
 
+void block_heatmap(uint32_t start, uint32_t end) {
+    /* like heatmap but showing blkio reads and writes for blocks start <= k < end */
+    uint64_t data[1024], dmax, d;
+    uint32_t i, j, zoom;
+
+    if (!blkstats.n) {
+        puts("No block IO recorded");
+        return;
+    }
+    if (end <= start) end = blkstats.hits[blkstats.n-1].blknum + 1;
+    if (end <= start) end = start + 1;
+
+    /* pick a power of two zoom so that 1024 characters cover the range */
+    for(zoom=0; zoom < 22 && (uint64_t)(start >> zoom << zoom) + ((uint64_t)1024 << zoom) < end; zoom++) /**/ ;
+    start = start >> zoom << zoom;
+
+    /* aggregate by max, as for heatmap */
+    for(i=0; i<1024; i++) data[i] = 0;
+    for(j=0; j<blkstats.n; j++) {
+        if (blkstats.hits[j].blknum < start || blkstats.hits[j].blknum >= end) continue;
+        i = (blkstats.hits[j].blknum - start) >> zoom;
+        d = blkstats.hits[j].reads + blkstats.hits[j].writes;
+        if (i < 1024 && data[i] < d) data[i] = d;
+    }
+    for(dmax=i=0; i<1024; i++)
+        if (data[i] > dmax) dmax = data[i];
+    heat_scale = (int)(bitlen(dmax)/7.0 + 0.5);
+    if (!heat_scale) heat_scale = 1;
+
+    printf("\n%s\n", blkstats.fname);
+    for(i=0; i<1024; i++) {
+        if (start + ((uint64_t)i << zoom) >= end) break;
+        if (!(i & 0x3f)) printf("%8x ", start + (i << zoom));
+        if (!(i & 0xf)) printf(" ");
+        printf("%s", heatstr(data[i]));
+        if ((i & 0x3f) == 0x3f) puts("");
+    }
+    if (i & 0x3f) puts("");
+    printf("\nrw blocks 0");
+    for(i=0; i<8; i++) {
+        d = 1 << (i * heat_scale);
+        printf(" %s $%" PRIx64, heatstr(d-1), d);
+    }
+    printf(" ($%x block%s/char)\n\n", 1 << zoom, zoom ? "s": "");
+}
+
 char* _fmt_addr(char *buf, uint16_t addr, int len) {
     const Symbol *sym = get_next_symbol_by_value(NULL, addr);
     if (sym) {
@@ -202,10 +421,13 @@ char* _fmt_addr(char *buf, uint16_t addr, int len) {
     return buf;
 }
 
-uint16_t disasm(uint16_t start, uint16_t end) {
+static uint16_t _disasm(uint16_t start, uint16_t end, int cycles) {
+    /* disassemble with execution counts, or with cycles */
     uint8_t op, k, n;
     int8_t offset;
-    char line[80], buf[32], *p;
+    uint16_t at;
+    /* room for two 16 character labels, each with its own half of buf, and 64 bit branch counts */
+    char line[256], buf[34], *p;
     const char *fmt;
     const Symbol *sym;
     const int n_fmt = strlen(TXT_LO);
@@ -231,10 +453,10 @@ uint16_t disasm(uint16_t start, uint16_t end) {
         memset(line, ' ', sizeof(line));
         p = line;
         p += sprintf(
-            line, "%c%c %.4x  " TXT_LO,
+            line, "%c%c %.4x  %s",
             pc == addr ? '*' : ' ',
             breakpoints[addr] & MONITOR_PC ? 'B': ' ',
-            addr
+            addr, TXT_LO
         );
 
         /* show bytes associated with this opcode */
@@ -246,30 +468,34 @@ uint16_t disasm(uint16_t start, uint16_t end) {
 
         /* show the name of the opcode, with heatmap */
         p = line + 19 + n_fmt;
-        p += sprintf(p, TXT_N "%s %.4s ", heatstr(heat_rs[addr]), opname(op));
-        addr++;
+        p += sprintf(p, "%s%s %.4s ", TXT_N, heatstr(cycles ? heat_cs[addr] : heat_rs[addr]), opname(op));
+        at = addr++;
 
         /* show the addressing mode detail */
         fmt = opfmt(op);
         if (n == 1) {
-            p += sprintf(p, "%s", fmt);
+            p += snprintf(p, line + sizeof(line) - p, "%s", fmt);
         } else if (strchr(fmt, '#')) { /* immediate? */
-            p += sprintf(p, fmt, memory[addr++]);
+            p += snprintf(p, line + sizeof(line) - p, fmt, memory[addr++]);
         } else if (strchr(fmt, ';')) { /* relative? */
             /* 1 or 2 bytes with relative address */
             offset = memory[addr + n-2];
             if (n==3) {
-                p += sprintf(p, fmt, _fmt_addr(buf+16, memory[addr], 2), _fmt_addr(buf, addr+2+offset, 4), offset);
+                p += snprintf(p, line + sizeof(line) - p, fmt, _fmt_addr(buf+17, memory[addr], 2), _fmt_addr(buf, addr+2+offset, 4), offset);
                 addr+=2;
             } else {
-                p += sprintf(p, fmt, _fmt_addr(buf, addr+1+offset, 4), offset);
+                p += snprintf(p, line + sizeof(line) - p, fmt, _fmt_addr(buf, addr+1+offset, 4), offset);
                 addr++;
             }
+            /* show how often the branch was taken, and the extra cycles */
+            if (branch_taken[at] || branch_not[at])
+                p += snprintf(p, line + sizeof(line) - p, "  taken %" PRIu64 "/%" PRIu64 " +%" PRIu64,
+                    branch_taken[at], branch_taken[at] + branch_not[at], branch_extra[at]);
         } else if (n==2) {
-            p += sprintf(p, fmt, _fmt_addr(buf, memory[addr], 2));
+            p += snprintf(p, line + sizeof(line) - p, fmt, _fmt_addr(buf, memory[addr], 2));
             addr++;
         } else {
-            p += sprintf(p, fmt, _fmt_addr(buf, *(uint16_t*)(memory+addr), 4));
+            p += snprintf(p, line + sizeof(line) - p, fmt, _fmt_addr(buf, *(uint16_t*)(memory+addr), 4));
             addr += 2;
         }
         puts(line);
@@ -277,6 +503,10 @@ uint16_t disasm(uint16_t start, uint16_t end) {
     return addr;
 }
 
+uint16_t disasm(uint16_t start, uint16_t end) {
+    return _disasm(start, end, 0);
+}
+
 void dump(uint16_t start, uint16_t end) {
     /*
     0         1         2         3         4         5         6         7
@@ -359,6 +589,54 @@ void cmd_next() {
     _cmd_single(STEP_NEXT);
 }
 
+void cmd_rstep() {
+    /* step backwards by replaying from the nearest earlier checkpoint */
+    int v;
+
+    if (E_OK != parse_int(&v, 1) || E_OK != parse_end()) return;
+    if (v < 1) {
+        _error("Count must be positive");
+        return;
+    }
+    if (E_OK != reverse_step(v)) {
+        monitor_errors++;
+        return;
+    }
+    org = pc;
+    disasm(pc, pc+1);
+}
+
+void cmd_rcontinue() {
+    /* run backwards until the previous breakpoint */
+    if (E_OK != parse_end()) return;
+    if (E_OK != reverse_continue()) {
+        monitor_errors++;
+        return;
+    }
+    org = pc;
+    disasm(pc, pc+1);
+}
+
+void cmd_history() {
+    /* history [on [interval [count]]|off] */
+    const char *_names[] = { "on", "off", 0 };
+    const int _vals[] = {1, 2};
+    uint8_t cmd;
+    int every = 100000, count = 64;
+
+    if (E_MISSING == parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL)) {
+        if (E_OK == parse_end()) reverse_show();
+        return;
+    }
+    if (cmd == 1 && (E_OK != parse_int(&every, every) || E_OK != parse_int(&count, count))) return;
+    if (E_OK != parse_end()) return;
+    if (every < 1 || count < 2) {
+        _error("Interval must be positive and count at least 2");
+        return;
+    }
+    reverse_enable(every, cmd == 1 ? count : 0);
+}
+
 void cmd_call() {
     uint16_t ret = pc, target;
 
@@ -372,6 +650,7 @@ void cmd_call() {
     /* write return address to stack, directly via memory[] to avoid callbacks */
     memory[BASE_STACK + sp] = (ret >> 8) & 0xFF;
     memory[BASE_STACK + ((sp - 1) & 0xFF)] = ret & 0xFF;
+    dirty_pages[BASE_STACK >> 8] = 1;
     sp -= 2;
 
     step_mode = STEP_RUN;
@@ -380,7 +659,8 @@ void cmd_call() {
 void cmd_signal() {
     const char* _names[] = {"reset", "irq", "nmi", 0};
     const int _vals[] = {0, 1, 2};
-    uint8_t v;
+    uint8_t v, sp_before = sp;
+    uint16_t pc_before = pc;
 
     if (E_OK != parse_enum(_names, _vals, &v, DEFAULT_REQUIRED) || E_OK != parse_end()) return;
 
@@ -389,14 +669,33 @@ void cmd_signal() {
         case 1: irq6502(); break;
         case 2: nmi6502(); break;
     }
+    /* let the profiler see the interrupt handler as a call */
+    if (profile_on) {
+        if (v == 0) profile_unwind();
+        else if (sp != sp_before) profile_call(pc_before, pc, sp_before);
+    }
 }
 
 void cmd_disasm() {
+    /* disassemble [range] [c], with c to show cycles rather than counts in the heat */
+    const char *_names[] = { "cycles", 0 };
+    const int _vals[] = { 1 };
     uint16_t start, end;
+    uint8_t cycles = 0;
+
+    /* try the mode first in case range was omitted, otherwise 'dis c' reads c as the carry flag */
+    if (E_OK == parse_enum(_names, _vals, &cycles, DEFAULT_OPTIONAL)) {
+        if (
+            E_OK != parse_range(&start, &end, org, 48)
+            || E_OK != parse_end()
+        ) return;
+    } else if (
+        E_OK != parse_range(&start, &end, org, 48)
+        || E_OK != parse_enum(_names, _vals, &cycles, 0)
+        || E_OK != parse_end()
+    ) return;
 
-    if (E_OK != parse_range(&start, &end, org, 48) || E_OK != parse_end()) return;
-
-    org = disasm(start, end);
+    org = _disasm(start, end, cycles);
 }
 
 void cmd_memory() {
@@ -453,8 +752,8 @@ void cmd_delete() {
 
 void cmd_inspect() {
     /* show breakpoints and labels for a range of memory */
-    uint16_t start, end, nmax, raddr, waddr, xaddr;
-    uint64_t rmax, wmax, xmax;
+    uint16_t start, end, nmax, raddr, waddr, xaddr, caddr;
+    uint64_t rmax, wmax, xmax, cmax;
     int endl, addr, span, n, prv, brk, new;
     const Symbol *sym;
 
@@ -470,6 +769,7 @@ void cmd_inspect() {
         if (addr==start || heat_rs[addr] > rmax) rmax = heat_rs[raddr=addr];
         if (addr==start || heat_ws[addr] > wmax) wmax = heat_ws[waddr=addr];
         if (addr==start || heat_xs[addr] > xmax) xmax = heat_xs[xaddr=addr];
+        if (addr==start || heat_cs[addr] > cmax) cmax = heat_cs[caddr=addr];
         if (n >= nmax) continue;
 
         brk = breakpoints[addr] & MONITOR_ANY;
@@ -509,22 +809,144 @@ void cmd_inspect() {
     if (n >= nmax) puts("...");
     else if (n == 0) puts("(no labels or breakpoints found)");
     printf(
-        "hotspots: $%" PRIx64 " read @ %.4x; $%" PRIx64 " write @ %.4x; $%" PRIx64 " execute @ %.4x\n",
-        rmax, raddr, wmax, waddr, xmax, xaddr
+        "hotspots: $%" PRIx64 " read @ %.4x; $%" PRIx64 " write @ %.4x; $%" PRIx64 " execute @ %.4x;"
+        " $%" PRIx64 " cycles @ %.4x\n",
+        rmax, raddr, wmax, waddr, xmax, xaddr, cmax, caddr
     );
 }
 
+static int _cmp_branch(const void *p, const void *q) {
+    uint16_t a = *(const uint16_t *)p, b = *(const uint16_t *)q;
+    return branch_extra[a] < branch_extra[b] ? 1 : (branch_extra[a] > branch_extra[b] ? -1 : a - b);
+}
+
+void cmd_branches() {
+    /* branches clear | [range] [n] - show the branches in range with the most extra cycles */
+    const char *_names[] = { "clear", 0 };
+    const int _vals[] = {1};
+    uint16_t start = 0, end = 0, *addrs;
+    uint64_t taken = 0, total = 0, extra = 0;
+    uint8_t cmd = 0;
+    int top = 20, err, endl, addr, i, n = 0;
+    const Symbol *sym;
+
+    err = parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL);
+    if (err != E_OK && err != E_MISSING) return;
+    if (cmd == 1) {
+        if (E_OK != parse_end()) return;
+        memset(branch_taken, 0, sizeof(branch_taken));
+        memset(branch_not, 0, sizeof(branch_not));
+        memset(branch_extra, 0, sizeof(branch_extra));
+        return;
+    }
+    if (
+        E_OK != parse_range(&start, &end, 0, 0)
+        || E_OK != parse_int(&top, top)
+        || E_OK != parse_end()
+    ) return;
+
+    endl = end <= start ? 0x10000 : end;
+    addrs = malloc((endl - start) * sizeof(uint16_t));
+    for (addr=start; addr < endl; addr++) {
+        if (!branch_taken[addr] && !branch_not[addr]) continue;
+        addrs[n++] = addr;
+        taken += branch_taken[addr];
+        total += branch_taken[addr] + branch_not[addr];
+        extra += branch_extra[addr];
+    }
+    if (!n) {
+        puts("(no branches found)");
+        free(addrs);
+        return;
+    }
+    qsort(addrs, n, sizeof(uint16_t), _cmp_branch);
+    puts("addr  label            op         taken  not taken  taken%   extra");
+    for (i=0; i<n && i<top; i++) {
+        addr = addrs[i];
+        sym = get_next_symbol_by_value(NULL, addr);
+        printf(
+            "%.4x  %-16.16s %.4s %10" PRIu64 " %10" PRIu64 " %6.1f%% %7" PRIu64 "\n",
+            addr, sym ? sym->name : "", opname(memory[addr]), branch_taken[addr], branch_not[addr],
+            100.0 * branch_taken[addr] / (branch_taken[addr] + branch_not[addr]), branch_extra[addr]
+        );
+    }
+    if (n > top) puts("...");
+    printf("total %d branches %10" PRIu64 " %10" PRIu64 " %6.1f%% %7" PRIu64 "\n",
+        n, taken, total - taken, 100.0 * taken / total, extra);
+    free(addrs);
+}
+
+static int _cmp_crossings(const void *p, const void *q) {
+    uint16_t a = *(const uint16_t *)p, b = *(const uint16_t *)q;
+    return page_crossings[a] < page_crossings[b] ? 1 : (page_crossings[a] > page_crossings[b] ? -1 : a - b);
+}
+
+void cmd_crossings() {
+    /* crossings clear | [range] [n] - show the instructions in range with the most page crossing penalties */
+    const char *_names[] = { "clear", 0 };
+    const int _vals[] = {1};
+    uint16_t start = 0, end = 0, *addrs;
+    uint64_t total = 0;
+    uint8_t cmd = 0, op;
+    int top = 20, err, endl, addr, i, n = 0;
+    const Symbol *sym;
+    char buf[32], operand[32];
+
+    err = parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL);
+    if (err != E_OK && err != E_MISSING) return;
+    if (cmd == 1) {
+        if (E_OK == parse_end()) memset(page_crossings, 0, sizeof(page_crossings));
+        return;
+    }
+    if (
+        E_OK != parse_range(&start, &end, 0, 0)
+        || E_OK != parse_int(&top, top)
+        || E_OK != parse_end()
+    ) return;
+
+    endl = end <= start ? 0x10000 : end;
+    addrs = malloc((endl - start) * sizeof(uint16_t));
+    for (addr=start; addr < endl; addr++) {
+        if (!page_crossings[addr]) continue;
+        addrs[n++] = addr;
+        total += page_crossings[addr];
+    }
+    if (!n) {
+        puts("(no page crossings found)");
+        free(addrs);
+        return;
+    }
+    qsort(addrs, n, sizeof(uint16_t), _cmp_crossings);
+    puts("addr  label            instruction                  count  crossings      %");
+    for (i=0; i<n && i<top; i++) {
+        addr = addrs[i];
+        op = memory[addr];
+        sym = get_next_symbol_by_value(NULL, addr);
+        /* the operand is the table base for abs,x and abs,y, or the pointer for (zp),y */
+        if (oplen(op) == 3) sprintf(operand, opfmt(op), _fmt_addr(buf, memory[addr+1] | (memory[(uint16_t)(addr+2)] << 8), 4));
+        else sprintf(operand, opfmt(op), _fmt_addr(buf, memory[(uint16_t)(addr+1)], 2));
+        printf(
+            "%.4x  %-16.16s %.4s %-23.23s %10" PRIu64 " %10" PRIu64 " %5.1f%%\n",
+            addr, sym ? sym->name : "", opname(op), operand, heat_xs[addr], page_crossings[addr],
+            heat_xs[addr] ? 100.0 * page_crossings[addr] / heat_xs[addr] : 0
+        );
+    }
+    if (n > top) puts("...");
+    printf("%" PRIu64 " cycles could be saved by aligning tables at %d address%s\n", total, n, n == 1 ? "" : "es");
+    free(addrs);
+}
+
 void cmd_set() {
     char *name;
     int v;
     name = parse_delim();
     if (!name) {
-        puts("Missing register/flag, expected one of a,x,y,sp,pc or n,v,b,d,i,z,c");
+        _error("Missing register/flag, expected one of a,x,y,sp,pc or n,v,b,d,i,z,c");
         return;
     }
     if (E_OK != parse_int(&v, DEFAULT_REQUIRED) || E_OK != parse_end()) return;
     if (E_OK != set_reg_or_flag(name, v))
-        puts("Unknown register/flag, expected one of a,x,y,sp,pc or n,v,b,d,i,z,c");
+        _error("Unknown register/flag, expected one of a,x,y,sp,pc or n,v,b,d,i,z,c");
 }
 
 void cmd_ticks() {
@@ -549,10 +971,11 @@ void cmd_fill() {
 
     endl = end < start ? 0x10000 : end;
     if (start == end) {
-        puts("Empty range, nothing to fill");
+        _error("Empty range, nothing to fill");
         return;
     }
     addr = start;
+    mark_dirty(start, endl - start);
 
     if (E_OK != parse_byte(&v, 0)) return;
     memory[addr++] = v;
@@ -595,7 +1018,7 @@ void cmd_convert() {
             printf("  '%c", v);
         puts("");
     }
-    if (!n) puts("No values to convert");
+    if (!n) _error("No values to convert");
 }
 
 void cmd_label() {
@@ -604,7 +1027,7 @@ void cmd_label() {
 
     lbl = parse_delim();
     if (strlen(lbl) != symlen(lbl)) {
-        puts("Invalid label");
+        _error("Invalid label");
         return;
     }
     if (E_OK != parse_addr(&addr, pc) || E_OK != parse_end()) return;
@@ -617,17 +1040,63 @@ void cmd_unlabel() {
 
     if (E_OK != parse_addr(&addr, DEFAULT_REQUIRED) || E_OK != parse_end()) return;
 
-    if (0 == remove_symbols_by_value(addr))
+    if (0 == remove_symbols_by_value(addr)) {
         printf("No labels for $%.4x\n", addr);
-
+        monitor_errors++;
+    }
 }
 
 void cmd_blockfile() {
-    char *p = parse_delim();
+    /* blockfile [pack src] file | stats [n] | heatmap [start [end]] */
+    const char *src = NULL, *_sub_names[] = { "pack", "stats", "heatmap", 0 };
+    const int _sub_vals[] = {1, 2, 3};
+    uint8_t cmd = 0;
+    char *p;
+    int i, n;
+    uint32_t start, end;
+    uint64_t count;
+
+    /* subcommands must be spelled out, so a block file can be called stats or s */
+    p = parse_delim();
+    for (i=0; p && _sub_names[i]; i++) if (!strcasecmp(p, _sub_names[i])) cmd = _sub_vals[i];
+    if (cmd == 2) {
+        if (E_OK != parse_int(&n, 16) || E_OK != parse_end()) return;
+        io_blkstats_print(n);
+        return;
+    }
+    if (cmd == 3) {
+        if (
+            E_OK != parse_u32(&start, 0)
+            || E_OK != parse_u32(&end, 0)
+            || E_OK != parse_end()
+        ) return;
+        /* blocks beyond the end of the file can't have been used */
+        count = io_blkcount();
+        if (start && start >= count) {
+            printf("Block $%x is past the end of the block file ($%" PRIx64 " blocks)\n", start, count);
+            monitor_errors++;
+            return;
+        }
+        if (end > count) end = (uint32_t)count;
+        block_heatmap(start, end);
+        return;
+    }
+    if (cmd == 1) {
+        if (!(src = parse_delim())) {
+            _error("Missing source block file name");
+            return;
+        }
+        p = parse_delim();
+    }
     if (E_OK != parse_end()) return;
 
-    if(!p) puts("Missing block file name");
-    else io_blkfile(p);
+    if(!p) _error("Missing block file name");
+    else if (cmd == 1) {
+        if ((n = blk_pack(src, p)) >= 0)
+            printf("Packed %d non-zero block%s from %s to %s\n", n, n==1 ? "": "s", src, p);
+        else monitor_errors++;
+    }
+    else if (io_blkfile(p)) monitor_errors++;
 }
 
 void cmd_load() {
@@ -635,12 +1104,12 @@ void cmd_load() {
     uint16_t addr;
 
     if (!fname) {
-        puts("Missing rom file name");
+        _error("Missing rom file name");
         return;
     }
     if (E_OK != parse_addr(&addr, DEFAULT_REQUIRED) || E_OK != parse_end()) return;
 
-    (void)load_memory(fname, addr);
+    if (load_memory(fname, addr)) monitor_errors++;
     org = addr;
 }
 
@@ -649,36 +1118,105 @@ void cmd_save() {
     uint16_t start, end;
 
     if (!fname) {
-        puts("Missing file name");
+        _error("Missing file name");
         return;
     }
     if (E_OK != parse_range(&start, &end, 0, 0) || E_OK != parse_end()) return;
 
     if (start == end) end = 0;
-    (void)save_memory(fname, start, end);
+    if (save_memory(fname, start, end)) monitor_errors++;
     org = start;
 }
 
+void cmd_snapshot() {
+    /* snapshot save file [debug] [delta] | load file | base | reset */
+    const char *fname = NULL, *_sub_names[] = { "save", "load", "base", "reset", 0 },
+        *_opt_names[] = { "debug", "delta", 0 };
+    const int _sub_vals[] = {1, 2, 3, 4}, _opt_vals[] = {SNAPSHOT_DEBUG, SNAPSHOT_DELTA};
+    uint8_t cmd, opt, flags = 0;
+    int err = 0;
+
+    if (E_OK != parse_enum(_sub_names, _sub_vals, &cmd, DEFAULT_REQUIRED)) return;
+    if (cmd < 3 && !(fname = parse_delim())) {
+        _error("Missing snapshot file name");
+        return;
+    }
+    while (cmd == 1 && E_OK == parse_enum(_opt_names, _opt_vals, &opt, DEFAULT_OPTIONAL))
+        flags |= opt;
+    if (E_OK != parse_end()) return;
+
+    switch (cmd) {
+        case 1: err = snapshot_save(fname, flags); break;
+        case 2: if (E_OK == (err = snapshot_load(fname))) org = pc; break;
+        case 3: snapshot_base(); break;
+        case 4: if (E_OK == (err = snapshot_reset())) org = pc; break;
+    }
+    if (err) monitor_errors++;
+}
+
+
+static void _heat_record_cmd() {
+    /* heatmap record [every cycles file | off] */
+    const char *fname, *_names[] = { "every", "off", 0 };
+    const int _vals[] = {1, 2};
+    char *p;
+    uint8_t cmd;
+    int every;
+
+    if (E_MISSING == parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL)) {
+        if (E_OK == parse_end()) _heat_record_show();
+        return;
+    }
+    if (cmd == 2) {
+        if (E_OK != parse_end()) return;
+        if (!hr_file) _error("Heatmap recording is off");
+        heat_record_stop();
+        return;
+    }
+    /*
+    take the count as a single word, since a filename like /tmp/heat would
+    continue the expression, and evaluate it last as that moves the cursor
+    */
+    p = parse_delim();
+    if (!(fname = parse_delim())) {
+        _error("Missing filename");
+        return;
+    }
+    if (E_OK != parse_end()) return;
+    if (strexpr(p, &every)) _error("Invalid cycle count");
+    else if (every < 1) _error("Interval must be positive");
+    else if (!heat_on) _error("Heatmap counts are off, see --no-heat");
+    else if (heat_record_start(fname, every) != 0) monitor_errors++;
+}
 
 void cmd_heatmap() {
-    /* heatmap [clear|save mapfile] [range] [r|w|d|x] */
+    /* heatmap [clear|save mapfile|record ...] [range] [r|w|d|x|c] */
     uint16_t start=0, end=0;
     uint8_t mode, cmd=0;
-    const char *fname, *_sub_names[] = { "clear", "save", 0 };
-    const int _sub_vals[] = {1, 2};
+    /* a lone c is the cycles mode rather than clear, and r or re is read rather than record */
+    const char *fname, *_sub_names[] = { "c", "clear", "save", "read", "record", 0 };
+    const int _sub_vals[] = {3, 1, 2, 4, 5};
     int err;
 
     err = parse_enum(_sub_names, _sub_vals, &cmd, DEFAULT_OPTIONAL);
     if (err != E_OK && err != E_MISSING) return;
+    if (cmd == 5) {
+        _heat_record_cmd();
+        return;
+    }
     if (cmd == 2 && !(fname = parse_delim())) {
-        puts("Missing filename");
+        _error("Missing filename");
         return;
     }
     /* try parsing a mode before range in case range was omitted, otherwise 'heat x' interprets
      * x as an expression defining the range... */
-    if (E_OK != parse_enum(_monitor_names, _monitor_vals, &mode, DEFAULT_OPTIONAL)) {
+    if (cmd == 3 || cmd == 4) {
+        mode = cmd == 3 ? HEAT_CYCLES : MONITOR_READ;
+        cmd = 0;
+        if (E_OK != parse_range(&start, &end, 0, 0)) return;
+    } else if (E_OK != parse_enum(_heat_names, _heat_vals, &mode, DEFAULT_OPTIONAL)) {
         if (E_OK != parse_range(&start, &end, 0, 0)) return;
-        if (E_OK != parse_enum(_monitor_names, _monitor_vals, &mode, MONITOR_DATA)) return;
+        if (E_OK != parse_enum(_heat_names, _heat_vals, &mode, MONITOR_DATA)) return;
     }
 
     switch (cmd) {
@@ -688,6 +1226,124 @@ void cmd_heatmap() {
     }
 }
 
+static int _cmp_op_ticks(const void *p, const void *q) {
+    uint8_t a = *(const uint8_t *)p, b = *(const uint8_t *)q;
+    return op_ticks[a] < op_ticks[b] ? 1 : (op_ticks[a] > op_ticks[b] ? -1 : a - b);
+}
+
+void opstats(int top) {
+    /* show the top opcodes by cycles */
+    uint8_t ops[256];
+    uint64_t count = 0, cycles = 0, penalty = 0;
+    int i, n = 0;
+
+    for (i=0; i<256; i++) {
+        if (!op_counts[i]) continue;
+        ops[n++] = i;
+        count += op_counts[i];
+        cycles += op_ticks[i];
+        penalty += op_penalty[i];
+    }
+    if (!n) {
+        puts(opstats_on ? "No instructions counted yet" : "Opcode statistics are off, see opstats on");
+        return;
+    }
+    qsort(ops, n, sizeof(uint8_t), _cmp_op_ticks);
+    puts("op  name mode          count       cycles    penalty  cycles");
+    for (i=0; i<n && i<top; i++)
+        printf(
+            "%.2x  %.4s %-8s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %6.1f%%\n",
+            ops[i], opname(ops[i]), opmodename(ops[i]),
+            op_counts[ops[i]], op_ticks[ops[i]], op_penalty[ops[i]], 100.0 * op_ticks[ops[i]] / cycles
+        );
+    if (n > top) puts("...");
+    printf("total %d opcodes %10" PRIu64 " %12" PRIu64 " %10" PRIu64 "\n", n, count, cycles, penalty);
+}
+
+void cmd_opstats() {
+    /* opstats [on|off|clear] | [n] */
+    const char *_names[] = { "on", "off", "clear", 0 };
+    const int _vals[] = {1, 2, 3};
+    uint8_t cmd;
+    int top = 20;
+
+    if (E_MISSING == parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL)) {
+        if (E_OK == parse_int(&top, top) && E_OK == parse_end()) opstats(top);
+        return;
+    }
+    if (E_OK != parse_end()) return;
+    switch (cmd) {
+        case 1: opstats_on = 1; break;
+        case 2: opstats_on = 0; break;
+        case 3:
+            memset(op_counts, 0, sizeof(op_counts));
+            memset(op_ticks, 0, sizeof(op_ticks));
+            memset(op_penalty, 0, sizeof(op_penalty));
+            break;
+    }
+}
+
+void cmd_profile() {
+    /* profile [on|off|clear] | sample cycles | [calls|labels] [n] | save [--callgrind] file, sample 0 is exact */
+    const char *fname, *_names[] = { "on", "off", "clear", "calls", "save", "sample", "labels", 0 };
+    const int _vals[] = {1, 2, 3, 4, 5, 6, 7};
+    uint8_t cmd = 0;
+    int top = 20, err, callgrind = 0, every;
+
+    err = parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL);
+    if (err != E_OK && err != E_MISSING) return;
+    if ((cmd == 0 || cmd == 4 || cmd == 7) && E_OK != parse_int(&top, top)) return;
+    if (cmd == 6 && E_OK != parse_int(&every, DEFAULT_REQUIRED)) return;
+    if (cmd == 5) {
+        fname = parse_delim();
+        if (fname && !strcmp(fname, "--callgrind")) {
+            callgrind = 1;
+            fname = parse_delim();
+        }
+        if (!fname) {
+            _error("Missing filename");
+            return;
+        }
+    }
+    if (E_OK != parse_end()) return;
+    switch (cmd) {
+        case 0: profile_show(top); break;
+        case 1: profile_enable(1); break;
+        case 2: profile_enable(0); break;
+        case 3: profile_clear(); break;
+        case 4: profile_show_calls(top); break;
+        case 6:
+            if (every >= 0) profile_sample(every);
+            else _error("Sample interval can't be negative");
+            break;
+        case 7: profile_show_labels(top); break;
+        case 5: if ((callgrind ? profile_save_callgrind(fname) : profile_save(fname)) != 0) monitor_errors++; break;
+    }
+}
+
+void cmd_regions() {
+    /* regions [clear | name id text | profile id] */
+    const char *name, *_names[] = { "clear", "name", "profile", 0 };
+    const int _vals[] = {1, 2, 3};
+    uint8_t cmd = 0, id;
+    int err;
+
+    err = parse_enum(_names, _vals, &cmd, DEFAULT_OPTIONAL);
+    if (err != E_OK && err != E_MISSING) return;
+    if ((cmd == 2 || cmd == 3) && E_OK != parse_byte(&id, DEFAULT_REQUIRED)) return;
+    if (cmd == 2 && !(name = parse_delim())) {
+        _error("Missing region name");
+        return;
+    }
+    if (E_OK != parse_end()) return;
+    switch (cmd) {
+        case 0: regions_show(); break;
+        case 1: regions_clear(); break;
+        case 2: regions_name(id, name); break;
+        case 3: regions_profile(id); break;
+    }
+}
+
 void cmd_quit() {
     if (E_OK != parse_end()) return;
     break_flag |= MONITOR_EXIT;
@@ -730,15 +1386,19 @@ Command _cmds[] = {
     { "continue [addr]", "- run from pc until breakpoint (or optional addr)", 1, cmd_continue },
     { "step", "- [count] step by single instructions", 1, cmd_step },
     { "next", "- [count] like step but treats jsr ... rts as one step", 1, cmd_next },
+    { "rstep", "- [count] step backwards by single instructions", 1, cmd_rstep },
+    { "rcontinue", "- run backwards until the previous breakpoint", 1, cmd_rcontinue },
     { "call", "addr - call subroutine leaving PC unchanged", 0, cmd_call },
     { "signal", "irq|nmi|reset - signal an interrupt", 0, cmd_signal },
 
-    { "disassemble", "[range] - show code disassembly for range (or current)", 1, cmd_disasm },
+    { "disassemble", "[range] [c] - show code disassembly for range (or current), with c to heat by cycles", 1, cmd_disasm },
     { "memory", "[range] - dump memory contents for range (or current)", 1, cmd_memory },
     { "stack", "- show stack contents, sp+1 through $1ff", 0, cmd_stack },
     { "break",  "[range] [r|w|d|x] - trigger break on read, write, any access or execute (default)", 0, cmd_break },
     { "delete",  "[range] - remove all breakpoints in range (default PC)", 0, cmd_delete },
     { "inspect", "[range] [max] - show labels and breakpoints in range, up to max lines", 0, cmd_inspect },
+    { "branches", "clear | [range] [n] - show how often branches in range were taken, top n by extra cycles", 0, cmd_branches },
+    { "crossings", "clear | [range] [n] - show the top n instructions in range by page crossing penalties", 0, cmd_crossings },
 
     { "set", "{a|x|y|sp|pc|n|v|d|i|z|c} value - modify a register or flag", 0, cmd_set },
     { "ticks", "[value] - query or set the current cycle count", 0, cmd_ticks },
@@ -749,8 +1409,19 @@ Command _cmds[] = {
 
     { "load", "romfile addr - read binary file to memory", 0, cmd_load },
     { "save", "romfile [range] - write memory to file (default full dump)", 0, cmd_save },
-    { "heatmap", " [clear|save mapfile] [range] [r|w|d|x] - view, reset or save heatmap data", 0, cmd_heatmap },
-    { "blockfile", "[blockfile] - use binary file for block storage, empty to disable", 0, cmd_blockfile },
+    { "snapshot", "save file [debug] [delta] | load file | base | reset - save or restore machine state,"
+        " with debug for breakpoints and labels, or delta for pages changed since the base", 0, cmd_snapshot },
+    { "heatmap", " [clear|save mapfile] [range] [r|w|d|x|c] | record [every cycles file | off]"
+        " - view, reset, save or record heatmap data, with c for cycles", 0, cmd_heatmap },
+    { "opstats", "[on|off|clear] | [n] - count executions by opcode, or show the top n by cycles", 0, cmd_opstats },
+    { "profile", "[on|off|clear] | sample cycles | [calls|labels] [n] | save [--callgrind] file - profile cycles"
+        " by subroutine, exactly or by sampling, showing the top n routines, calls or labels,"
+        " or save call stacks for a flame graph or KCachegrind", 0, cmd_profile },
+    { "regions", "[clear | name id text | profile id] - show costs of guest regions, name a region,"
+        " or profile only while a selected region is active (0 clears the selection)", 0, cmd_regions },
+    { "history", "[on [interval [count]]|off] - show, start or stop the checkpoints used by rstep and rcontinue", 0, cmd_history },
+    { "blockfile", "[pack src] blockfile | stats [n] | heatmap [start [end]] - use binary file for block storage,"
+        " pack src to a sparse container, or show block IO statistics", 0, cmd_blockfile },
     { "quit", "- leave c65", 0, cmd_quit },
     { "help", "or ? - show this help", 0, cmd_help },
     { "?", "", 0, cmd_help },    // this must be last
@@ -777,7 +1448,7 @@ void do_cmd() {
             return;
         }
     }
-    puts("Unknown command, try ? for help");
+    _error("Unknown command, try ? for help");
 }
 
 
@@ -797,14 +1468,21 @@ void monitor_init(const char * labelfile) {
     char buf[128], *s;
     const char *label;
     int skip=0, ok=0;
-    linenoiseSetCompletionCallback(completion, NULL);
-    linenoiseHistorySetMaxLen(256);
-    linenoiseHistoryLoad(".c65");
+
+    if (_script) {
+        /* headless mode has no line editing or colors */
+        _txt = _txt_none;
+    } else {
+        linenoiseSetCompletionCallback(completion, NULL);
+        linenoiseHistorySetMaxLen(256);
+        linenoiseHistoryLoad(".c65");
+    }
 
     if (labelfile) {
         f = fopen(labelfile, "r");
         if (!f) {
             printf("Can't read labels from %s\n", labelfile);
+            monitor_errors++;
             return;
         }
         /*
@@ -841,16 +1519,20 @@ void monitor_init(const char * labelfile) {
             );
         fclose(f);
     }
-    if (!quiet)
+    if (!quiet && !_script)
         puts("Type ? for help, ctrl-C to interrupt, quit to exit.");
 }
 
-void monitor_exit() {
-    linenoiseHistorySave(".c65");
+int monitor_exit() {
+    /* returns non-zero if a headless script stopped on an error */
+    heat_record_stop();
+    if (!_script) linenoiseHistorySave(".c65");
+    return _failed;
 }
 
 void monitor_command() {
     char *line;
+    int errors, comment;
 
     if (step_mode != STEP_NONE) {
         org = pc;
@@ -862,16 +1544,72 @@ void monitor_command() {
         disasm(pc, pc+1);
     }
 
-    line = linenoise(prompt());
-    if (!line) return;
+    if (_script) {
+        if (_script_pos == _script_len) {
+            break_flag |= MONITOR_EXIT;
+            return;
+        }
+        line = _script[_script_pos++];
+        /* echo the command like a transcript */
+        if (!quiet) printf("%s%s\n", prompt(), line);
+    } else {
+        line = linenoise(prompt());
+        if (!line) return;
+    }
 
+    errors = monitor_errors + parse_errors;
+    comment = line[strspn(line, " \t")] == ';';
     if (parse_start(line)) {
-        linenoiseHistoryAdd(line);
+        if (!_script) linenoiseHistoryAdd(line);
+        reverse_mark();
         do_cmd();
-    } else if (_repeat_cmd) {
-        /* empty line can repeat some commands */
+        reverse_check();
+    } else if (_repeat_cmd && !comment) {
+        /* empty line can repeat some commands, a line starting with ; is just a comment */
         _repeat_cmd->handler();
     }
-    free(line);
+    if (!_script) {
+        free(line);
+    } else if (monitor_exit_on_error && monitor_errors + parse_errors > errors) {
+        fprintf(stderr, "c65: stopping after error in script command %d\n", _script_pos);
+        break_flag |= MONITOR_EXIT;
+        _failed = 1;
+    }
+}
+
+static void _script_add(const char *cmd, size_t n) {
+    if (_script_len % 64 == 0) _script = realloc(_script, (_script_len + 64) * sizeof(char*));
+    _script[_script_len] = malloc(n + 1);
+    memcpy(_script[_script_len], cmd, n);
+    _script[_script_len++][n] = 0;
+}
+
+void monitor_script(const char *cmds) {
+    /*
+    queue commands separated by ; for headless mode, like "go; stack".
+    Every ; separates commands, even after a space, so a command is never
+    silently lost as a comment.  Use -E for a script with comments.
+    */
+    const char *p;
+
+    io_host_times = 0;
+    for (p = cmds; (p = strchr(p, ';')); cmds = ++p) _script_add(cmds, p - cmds);
+    _script_add(cmds, strlen(cmds));
+}
+
+int monitor_script_file(const char *fname) {
+    /* queue commands from a file, one per line, for headless mode */
+    FILE *f;
+    char buf[1024];
+
+    f = fopen(fname, "r");
+    if (!f) {
+        fprintf(stderr, "File not found: %s\n", fname);
+        return -1;
+    }
+    io_host_times = 0;
+    while (fgets(buf, sizeof(buf), f)) _script_add(buf, strcspn(buf, "\r\n"));
+    fclose(f);
+    return 0;
 }
 
@@ -1,3 +1,16 @@
+extern int monitor_errors;
+extern int monitor_exit_on_error;
+extern uint64_t heat_record_due;
+
 void monitor_init(const char *labelfile);
-void monitor_exit();
+int monitor_exit();
 void monitor_command();
+uint16_t disasm(uint16_t start, uint16_t end);
+
+int heat_record_start(const char *fname, uint64_t every);
+void heat_record();
+void heat_record_stop();
+void heat_record_rewind(uint64_t to);
+
+void monitor_script(const char *cmds);
+int monitor_script_file(const char *fname);
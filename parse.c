@@ -41,6 +41,7 @@ T --> val | "(" E ")" | ~ T
 Symbol *symbols = NULL;
 
 char *cursor, *parse_last;
+int parse_errors = 0;       /* count of errors reported, e.g. for headless mode */
 
 /* parser state variables */
 static unsigned char opstk[32]; /* stack of operators */
@@ -158,6 +159,10 @@ const Symbol* get_symbol(const char *name) {
     return sym;
 }
 
+const Symbol* get_next_symbol(const Symbol* sym) {
+    return sym ? sym->next : symbols;
+}
+
 const Symbol* get_next_symbol_by_value(const Symbol* sym, uint16_t value) {
     for(sym = sym ? sym ->next : symbols; sym && sym->value != value; sym = sym->next) /**/ ;
     return sym;
@@ -387,6 +392,8 @@ int strexpr(char *src, int *result) {
 
 void show_error(int error) {
     int i;
+
+    parse_errors++;
     switch(error) {
         case EX_EMPTY:
             puts("missing expression");
@@ -476,6 +483,7 @@ int parse_enum(const char *names[], const int vals[], uint8_t *v, int dflt) {
                 case DEFAULT_OPTIONAL: return E_MISSING;
                 case DEFAULT_REQUIRED:
                     printf("Missing required value:");
+                    parse_errors++;
                     for(i=0; names[i]; i++) printf(" %s", names[i]);
                     puts("");
                     return E_PARSE;
@@ -498,6 +506,7 @@ int parse_enum(const char *names[], const int vals[], uint8_t *v, int dflt) {
     if (dflt == DEFAULT_OPTIONAL) return E_MISSING;
 
     printf("Invalid value, expected:");
+    parse_errors++;
     for(i=0; names[i]; i++) printf(" %s", names[i]);
     puts("");
     return E_RANGE;
@@ -526,6 +535,7 @@ int parse_byte(uint8_t *v, int dflt) {
     if (E_OK != (err = parse_int(&tmp, dflt))) return err;
     if (abs(tmp) > 255) {
         printf("byte: value %d out of range\n", tmp);
+        parse_errors++;
         return E_RANGE;
     }
     *v = (uint8_t)(tmp & 0xff);
@@ -539,12 +549,22 @@ int parse_addr(uint16_t *v, int dflt) {
     if (E_OK != (err = parse_int(&tmp, dflt))) return err;
     if (tmp < 0 || tmp > 0xffff) {
         printf("address: value %d out of range\n", tmp);
+        parse_errors++;
         return E_RANGE;
     }
     *v = (uint16_t)(tmp & 0xffff);
     return E_OK;
 }
 
+/* an unsigned 32-bit value, where $80000000 and up come back from strexpr as negative ints */
+int parse_u32(uint32_t *v, int dflt) {
+    int tmp, err;
+
+    if (E_OK != (err = parse_int(&tmp, dflt))) return err;
+    *v = (uint32_t)tmp;
+    return E_OK;
+}
+
 /* parse a range expression start.end or start,offset */
 int parse_range(uint16_t* start, uint16_t* end, int dflt_start, int dflt_length) {
     int dflt, err;
@@ -569,6 +589,7 @@ int parse_range(uint16_t* start, uint16_t* end, int dflt_start, int dflt_length)
         /* no explicit . end or .. offset so use default if there is one */
         if (dflt_length == DEFAULT_REQUIRED) {
             puts("range missing required .end or ..offset");
+            parse_errors++;
             return E_MISSING;
         }
         *end = *start + dflt_length;
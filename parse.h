@@ -10,9 +10,11 @@ typedef struct Symbol {
 } Symbol;
 
 extern const char *pexpr;
+extern int parse_errors;
 
 void add_symbol(const char* name, uint16_t value);
 const Symbol* get_symbol(const char *name);
+const Symbol* get_next_symbol(const Symbol* sym);
 const Symbol* get_next_symbol_by_value(const Symbol* sym, uint16_t value);
 void remove_symbol(const char *name);
 int remove_symbols_by_value(uint16_t value);
@@ -35,6 +37,7 @@ int parse_enum(const char *names[], const int vals[], uint8_t *v, int dflt);
 int parse_int(int *v, int dflt);
 int parse_byte(uint8_t *v, int dflt);
 int parse_addr(uint16_t *v, int dflt);
+int parse_u32(uint32_t *v, int dflt);
 int parse_range(uint16_t* start, uint16_t* end, int dflt_start, int dflt_length);
 
 char* parsed_str();
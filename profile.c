@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define FAKE6502_NOT_STATIC 1
+#define FAKE6502_INCLUDE 1
+#include "fake65c02.h"
+
+#include "profile.h"
+#include "c65.h"
+#include "parse.h"
+
+extern const char* SEMANTIC_VERSION;     /* from version.h, included by c65.c */
+
+/*
+Each frame on the shadow stack remembers the stack pointer before the call,
+so it ends when sp rises back to that level after an rts, rti or txs.
+That also unwinds frames whose return address the guest dropped,
+which is common in Forth.  Cycles are charged as exclusive time to the
+routine on top of the stack after every instruction, and as inclusive time
+when the outermost active call of a routine returns, so recursion isn't
+counted twice.  Code outside any call is charged to a pseudo routine ROOT.
+
+We also keep a calling context tree, with a node for each distinct path
+of calls from the top level, so we can write exclusive cycles by call stack
+in the folded format used by flame graph tools.  Node 0 is the top level.
+
+For callgrind output we also charge the cost of each instruction, counting
+instructions, cycles and bus reads and writes, to a site keyed by the routine
+on top of the stack and the instruction address.  A call adds a site keyed by
+the caller, the address of the calling instruction and the callee, which
+counts calls and collects the inclusive cost when each call returns.
+Samples only charge cycles, so sampled callgrind output has just that event.
+Sites live in an open addressing hash table like the edges.
+
+In sampling mode we still follow calls on the shadow stack, which only costs
+a switch on the opcode, but skip the per instruction accounting.  Instead,
+every `sample_every` cycles on average, with random jitter so we don't alias
+with loops, we charge the cycles since the last sample to the instruction
+just executed and its routine, and as inclusive time to each routine and call
+site on the stack.  The reports then show estimated cycles.
+*/
+
+#define ROOT 0x10000
+#define MAX_FRAMES 256
+#define SELF (ROOT + 1)     /* callee for the cost of a routine's own instructions */
+#define NCOSTS 4            /* instructions, cycles, reads and writes */
+
+typedef struct Routine {
+    uint64_t calls, incl, excl;
+    uint64_t enter;         /* ticks when the outermost active call started */
+    uint32_t active;        /* number of active calls */
+    uint32_t stamp;         /* last sample that charged this routine */
+} Routine;
+
+typedef struct Frame {
+    uint32_t routine, node;
+    uint32_t caller;
+    uint16_t site;          /* address of the calling instruction */
+    uint8_t sp;             /* stack pointer before the call */
+    uint64_t start[NCOSTS]; /* costs so far when the call started */
+} Frame;
+
+typedef struct Node {
+    uint32_t parent, routine;
+    uint64_t excl;
+} Node;
+
+typedef struct Edge {
+    uint32_t caller, callee;
+    uint64_t calls;
+} Edge;
+
+typedef struct Site {
+    uint64_t key;           /* routine, address and callee, plus one so zero is free */
+    uint64_t calls;
+    uint64_t cost[NCOSTS];
+} Site;
+
+int profile_on = 0;
+
+static Routine *routines = NULL;
+static Frame frames[MAX_FRAMES];
+static int nframes = 0, lost = 0;
+static Edge *edges = NULL;
+static uint32_t nedges = 0, edgecap = 0;
+static uint64_t start_ticks = 0;
+static uint64_t paused[NCOSTS];     /* costs when profiling was turned off */
+
+static Site *sites = NULL;
+static uint32_t nsites = 0, sitecap = 0;
+static uint64_t seen_reads = 0, seen_writes = 0;
+
+static uint32_t sample_every = 0, nsamples = 0, seed = 0x2545f491;
+static uint64_t sample_due = 0, last_sample = 0;
+
+static uint32_t *lines = NULL;      /* listing line by address, or 0 */
+static char *listfile = NULL;
+
+static Node *nodes = NULL;
+static uint32_t nnodes = 0, nodecap = 0;
+static uint32_t *nodeidx = NULL, idxcap = 0;   /* hash of nodes by parent and routine */
+
+
+static void _costs(uint64_t *c) {
+    c[0] = instructions;
+    c[1] = ticks;
+    c[2] = bus_reads;
+    c[3] = bus_writes;
+}
+
+static void _profiled(uint64_t *c) {
+    /* costs up to now, or up to the pause if profiling is off */
+    if (profile_on) _costs(c);
+    else memcpy(c, paused, sizeof(paused));
+}
+
+static void _schedule() {
+    /* pick the next sample time uniformly from half to one and a half intervals */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    sample_due = ticks + sample_every / 2 + seed % (sample_every ? sample_every : 1);
+}
+
+static void _resume() {
+    /* shift the start of the profile and of active calls past a pause */
+    uint64_t now[NCOSTS];
+    uint32_t i;
+    int j;
+
+    _costs(now);
+    for (j=0; j<NCOSTS; j++) now[j] -= paused[j];
+    start_ticks += now[1];
+    for (i=0; i<=ROOT; i++)
+        if (routines[i].active) routines[i].enter += now[1];
+    for (i=0; i<(uint32_t)nframes; i++)
+        for (j=0; j<NCOSTS; j++) frames[i].start[j] += now[j];
+}
+
+void profile_enable(int on) {
+    if (on && !routines) profile_clear();
+    else if (on && !profile_on) _resume();
+    else if (!on && profile_on) _costs(paused);
+    /* don't charge accesses or samples while we weren't looking */
+    seen_reads = bus_reads;
+    seen_writes = bus_writes;
+    last_sample = ticks;
+    _schedule();
+    profile_on = on;
+    if (on && !sample_every) bus_counting |= BUS_PROFILE;
+    else bus_counting &= ~BUS_PROFILE;
+}
+
+void profile_sample(uint32_t every) {
+    /* start a new profile, sampling every so many cycles or exact with 0 */
+    sample_every = every;
+    profile_clear();
+    profile_enable(1);
+}
+
+void profile_clear() {
+    free(routines);
+    routines = calloc(ROOT + 1, sizeof(Routine));
+    free(edges);
+    edges = NULL;
+    nedges = edgecap = 0;
+    free(sites);
+    sites = NULL;
+    nsites = sitecap = 0;
+    nframes = lost = 0;
+    start_ticks = last_sample = ticks;
+    _costs(paused);
+    seen_reads = bus_reads;
+    seen_writes = bus_writes;
+    nsamples = 0;
+    _schedule();
+
+    free(nodes);
+    free(nodeidx);
+    nodecap = 1024;
+    nodes = malloc(nodecap * sizeof(Node));
+    nodes[0].parent = nodes[0].routine = ROOT;
+    nodes[0].excl = 0;
+    nnodes = 1;
+    idxcap = 2048;
+    nodeidx = calloc(idxcap, sizeof(uint32_t));
+}
+
+
+static uint32_t _top() {
+    return nframes ? frames[nframes-1].routine : ROOT;
+}
+
+static uint32_t _top_node() {
+    return nframes ? frames[nframes-1].node : 0;
+}
+
+static uint32_t _hash(uint32_t caller, uint32_t callee) {
+    return (caller * 0x9e3779b1u) ^ (callee * 0x85ebca6bu);
+}
+
+static void _add_edge(uint32_t caller, uint32_t callee) {
+    /* open addressing hash table of edges, which we grow at half full */
+    Edge *old = edges;
+    uint32_t i, k, oldcap = edgecap;
+
+    if (2 * (nedges + 1) > edgecap) {
+        edgecap = edgecap ? 2 * edgecap : 1024;
+        edges = calloc(edgecap, sizeof(Edge));
+        for (i=0; i<oldcap; i++) {
+            if (!old[i].calls) continue;
+            for (k=_hash(old[i].caller, old[i].callee) & (edgecap-1); edges[k].calls; k = (k+1) & (edgecap-1)) /**/ ;
+            edges[k] = old[i];
+        }
+        free(old);
+    }
+    for (k=_hash(caller, callee) & (edgecap-1); edges[k].calls; k = (k+1) & (edgecap-1))
+        if (edges[k].caller == caller && edges[k].callee == callee) break;
+    if (!edges[k].calls) {
+        edges[k].caller = caller;
+        edges[k].callee = callee;
+        nedges++;
+    }
+    edges[k].calls++;
+}
+
+static Site *_site(uint32_t routine, uint16_t addr, uint32_t callee) {
+    /* find or add the site for routine's instruction at addr, or its call to callee there */
+    Site *old = sites;
+    uint64_t key = (((uint64_t)routine << 34) | ((uint64_t)addr << 17) | callee) + 1;
+    uint32_t i, k, oldcap = sitecap;
+
+    if (2 * (nsites + 1) > sitecap) {
+        sitecap = sitecap ? 2 * sitecap : 1024;
+        sites = calloc(sitecap, sizeof(Site));
+        for (i=0; i<oldcap; i++) {
+            if (!old[i].key) continue;
+            for (k=_hash(old[i].key >> 32, old[i].key) & (sitecap-1); sites[k].key; k = (k+1) & (sitecap-1)) /**/ ;
+            sites[k] = old[i];
+        }
+        free(old);
+    }
+    for (k=_hash(key >> 32, key) & (sitecap-1); sites[k].key; k = (k+1) & (sitecap-1))
+        if (sites[k].key == key) return sites + k;
+    sites[k].key = key;
+    nsites++;
+    return sites + k;
+}
+
+static uint32_t _child(uint32_t parent, uint32_t routine) {
+    /* find or add the context node for a call to routine from parent */
+    uint32_t i, k;
+
+    if (2 * nnodes > idxcap) {
+        free(nodeidx);
+        idxcap *= 2;
+        nodeidx = calloc(idxcap, sizeof(uint32_t));
+        for (i=1; i<nnodes; i++) {
+            for (k=_hash(nodes[i].parent, nodes[i].routine) & (idxcap-1); nodeidx[k]; k = (k+1) & (idxcap-1)) /**/ ;
+            nodeidx[k] = i;
+        }
+    }
+    for (k=_hash(parent, routine) & (idxcap-1); nodeidx[k]; k = (k+1) & (idxcap-1)) {
+        i = nodeidx[k];
+        if (nodes[i].parent == parent && nodes[i].routine == routine) return i;
+    }
+    if (nnodes == nodecap) {
+        nodecap *= 2;
+        nodes = realloc(nodes, nodecap * sizeof(Node));
+    }
+    nodes[nnodes].parent = parent;
+    nodes[nnodes].routine = routine;
+    nodes[nnodes].excl = 0;
+    nodeidx[k] = nnodes;
+    return nnodes++;
+}
+
+void profile_call(uint16_t site, uint16_t target, uint8_t sp_before) {
+    Routine *r = routines + target;
+
+    _add_edge(_top(), target);
+    _site(_top(), site, target)->calls++;
+    r->calls++;
+    if (!r->active++) r->enter = ticks;
+    if (nframes == MAX_FRAMES) {
+        /* forget the oldest frame, which is probably stale anyway */
+        memmove(frames, frames+1, (MAX_FRAMES-1) * sizeof(Frame));
+        nframes--;
+        lost++;
+    }
+    frames[nframes].routine = target;
+    frames[nframes].node = _child(_top_node(), target);
+    frames[nframes].caller = _top();
+    frames[nframes].site = site;
+    frames[nframes].sp = sp_before;
+    _costs(frames[nframes++].start);
+}
+
+void profile_unwind() {
+    /* end any calls whose stack frame is gone */
+    Routine *r;
+    Frame *f;
+    Site *s;
+    uint64_t now[NCOSTS];
+    int j;
+
+    _costs(now);
+    while (nframes && frames[nframes-1].sp <= sp) {
+        f = frames + --nframes;
+        r = routines + f->routine;
+        if (r->active && !--r->active && !sample_every) r->incl += ticks - r->enter;
+        if (sample_every) continue;
+        s = _site(f->caller, f->site, f->routine);
+        for (j=0; j<NCOSTS; j++) s->cost[j] += now[j] - f->start[j];
+    }
+}
+
+static void _sample(uint16_t addr) {
+    /* charge the cycles since the last sample to the current stack */
+    uint64_t dt = ticks - last_sample;
+    Routine *r;
+    int i;
+
+    last_sample = ticks;
+    _schedule();
+    nsamples++;
+    _site(_top(), addr, SELF)->cost[1] += dt;
+    routines[_top()].excl += dt;
+    nodes[_top_node()].excl += dt;
+    for (i=0; i<nframes; i++) {
+        r = routines + frames[i].routine;
+        if (r->stamp != nsamples) r->incl += dt;
+        r->stamp = nsamples;
+        _site(frames[i].caller, frames[i].site, frames[i].routine)->cost[1] += dt;
+    }
+}
+
+void profile_step(uint16_t addr, uint32_t dt) {
+    /* called after each instruction, with the address it was fetched from */
+    Site *s;
+
+    if (sample_every) {
+        if (ticks >= sample_due) _sample(addr);
+    } else {
+        s = _site(_top(), addr, SELF);
+        s->cost[0]++;
+        s->cost[1] += dt;
+        s->cost[2] += bus_reads - seen_reads;
+        s->cost[3] += bus_writes - seen_writes;
+        seen_reads = bus_reads;
+        seen_writes = bus_writes;
+        routines[_top()].excl += dt;
+        nodes[_top_node()].excl += dt;
+    }
+    switch (opcode) {
+        case 0x20:  /* jsr */
+            profile_call(addr, pc, sp + 2);
+            break;
+        case 0x00:  /* brk, unless it stopped the simulation */
+            if (!(break_flag & MONITOR_EXIT)) profile_call(addr, pc, sp + 3);
+            break;
+        case 0x40:  /* rti */
+        case 0x60:  /* rts */
+        case 0x9a:  /* txs */
+            profile_unwind();
+            break;
+    }
+}
+
+
+static const char *_name(uint32_t addr, char *buf) {
+    const Symbol *sym;
+
+    if (addr == ROOT) return "(top)";
+    if ((sym = get_next_symbol_by_value(NULL, addr))) return sym->name;
+    sprintf(buf, "$%.4x", addr);
+    return buf;
+}
+
+static uint64_t _incl(uint32_t addr) {
+    /* include the time so far for active calls */
+    Routine *r = routines + addr;
+    uint64_t now[NCOSTS];
+
+    _profiled(now);
+    if (addr == ROOT) return sample_every ? last_sample - start_ticks : now[1] - start_ticks;
+    return r->incl + (r->active && !sample_every ? now[1] - r->enter : 0);
+}
+
+static int _cmp_incl(const void *p, const void *q) {
+    uint64_t a = _incl(*(const uint32_t *)p), b = _incl(*(const uint32_t *)q);
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+void profile_show(int top) {
+    /* show the top routines by inclusive cycles */
+    uint32_t *addrs, i, n = 0;
+    uint64_t total = _incl(ROOT);
+    char buf[8];
+
+    if (!routines) {
+        puts("Profiling is off, see profile on");
+        return;
+    }
+    addrs = malloc((ROOT + 1) * sizeof(uint32_t));
+    for (i=0; i<=ROOT; i++)
+        if (routines[i].calls || routines[i].excl) addrs[n++] = i;
+    qsort(addrs, n, sizeof(uint32_t), _cmp_incl);
+
+    if (sample_every) printf("Sampled %" PRIu64 " cycles every %u on average in %u routines", total, sample_every, n);
+    else printf("Profiled %" PRIu64 " cycles in %u routines", total, n);
+    if (nframes) printf(", %d calls active", nframes);
+    if (lost) printf(", %d frames lost", lost);
+    puts("\n     calls    inclusive        %    exclusive        %  routine");
+    for (i=0; i<n && i<top; i++)
+        printf(
+            "%10" PRIu64 " %12" PRIu64 " %7.1f%% %12" PRIu64 " %7.1f%%  %s\n",
+            routines[addrs[i]].calls, _incl(addrs[i]), total ? 100.0 * _incl(addrs[i]) / total : 0,
+            routines[addrs[i]].excl, total ? 100.0 * routines[addrs[i]].excl / total : 0,
+            _name(addrs[i], buf)
+        );
+    if (n > top) puts("...");
+    free(addrs);
+}
+
+static int _cmp_calls(const void *p, const void *q) {
+    const Edge *a = p, *b = q;
+    return a->calls < b->calls ? 1 : (a->calls > b->calls ? -1 : 0);
+}
+
+void profile_show_calls(int top) {
+    /* show the most frequent caller to callee edges */
+    Edge *sorted;
+    uint32_t i, n = 0;
+    char buf[8], buf2[8];
+
+    if (!routines) {
+        puts("Profiling is off, see profile on");
+        return;
+    }
+    sorted = malloc((nedges ? nedges : 1) * sizeof(Edge));
+    for (i=0; i<edgecap; i++)
+        if (edges[i].calls) sorted[n++] = edges[i];
+    qsort(sorted, n, sizeof(Edge), _cmp_calls);
+    puts("     calls  caller -> callee");
+    for (i=0; i<n && i<top; i++)
+        printf("%10" PRIu64 "  %s -> %s\n", sorted[i].calls, _name(sorted[i].caller, buf), _name(sorted[i].callee, buf2));
+    if (n > top) puts("...");
+    free(sorted);
+}
+
+static const Symbol **label_syms;
+static uint64_t *label_cycles;
+
+static int _cmp_value(const void *p, const void *q) {
+    return (*(const Symbol **)p)->value - (*(const Symbol **)q)->value;
+}
+
+static int _cmp_label(const void *p, const void *q) {
+    uint64_t a = label_cycles[*(const uint32_t *)p], b = label_cycles[*(const uint32_t *)q];
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+void profile_show_labels(int top) {
+    /* show cycles by the nearest label at or before each instruction, which doesn't need calls */
+    const Symbol *sym;
+    uint32_t *order, nsyms = 0, i, n = 0, lo, hi, mid, addr;
+    uint64_t total = 0;
+
+    if (!routines) {
+        puts("Profiling is off, see profile on");
+        return;
+    }
+    for (sym = get_next_symbol(NULL); sym; sym = get_next_symbol(sym)) nsyms++;
+    label_syms = malloc((nsyms + 1) * sizeof(Symbol *));
+    for (i=0, sym = get_next_symbol(NULL); sym; sym = get_next_symbol(sym)) label_syms[i++] = sym;
+    qsort(label_syms, nsyms, sizeof(Symbol *), _cmp_value);
+    /* the last entry is for code before the first label */
+    label_cycles = calloc(nsyms + 1, sizeof(uint64_t));
+    for (i=0; i<sitecap; i++) {
+        if (!sites[i].key || ((sites[i].key - 1) & 0x1ffff) != SELF) continue;
+        addr = ((sites[i].key - 1) >> 17) & 0xffff;
+        for (lo=0, hi=nsyms; lo < hi; /**/) {
+            mid = (lo + hi) / 2;
+            if (label_syms[mid]->value <= addr) lo = mid + 1;
+            else hi = mid;
+        }
+        label_cycles[lo ? lo - 1 : nsyms] += sites[i].cost[1];
+        total += sites[i].cost[1];
+    }
+    order = malloc((nsyms + 1) * sizeof(uint32_t));
+    for (i=0; i<=nsyms; i++)
+        if (label_cycles[i]) order[n++] = i;
+    qsort(order, n, sizeof(uint32_t), _cmp_label);
+    puts("      cycles        %  label");
+    for (i=0; i<n && i<top; i++)
+        printf(
+            "%12" PRIu64 " %7.1f%%  %s\n", label_cycles[order[i]], 100.0 * label_cycles[order[i]] / total,
+            order[i] < nsyms ? label_syms[order[i]]->name : "(unlabeled)"
+        );
+    if (n > top) puts("...");
+    free(order);
+    free(label_cycles);
+    free(label_syms);
+}
+
+int profile_save(const char *fname) {
+    /* write exclusive cycles by call stack as folded stacks, like "main;foo;bar 1234" */
+    FILE *fout;
+    uint32_t *path, i, k, n;
+    char buf[8];
+
+    if (!routines) {
+        puts("Profiling is off, see profile on");
+        return -1;
+    }
+    fout = fopen(fname, "w");
+    if (!fout) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        return -1;
+    }
+    path = malloc(nnodes * sizeof(uint32_t));
+    for (i=0; i<nnodes; i++) {
+        if (!nodes[i].excl) continue;
+        for (n=0, k=i; k; k=nodes[k].parent) path[n++] = k;
+        if (!n) fputs(_name(ROOT, buf), fout);
+        while (n--) fprintf(fout, "%s%s", _name(nodes[path[n]].routine, buf), n ? ";" : "");
+        fprintf(fout, " %" PRIu64 "\n", nodes[i].excl);
+    }
+    free(path);
+    fclose(fout);
+    if (!quiet) printf("c65: wrote %u call stacks to %s\n", nnodes, fname);
+    return 0;
+}
+
+
+int profile_listing(const char *fname) {
+    /* read source positions from a 64tass listing, with lines like ".ff00  d8  cld  RESET cld" */
+    FILE *fin;
+    char buf[256], *p, *q;
+    uint32_t n = 0;
+    unsigned long addr;
+    int bol = 1;
+
+    fin = fopen(fname, "r");
+    if (!fin) {
+        fprintf(stderr, "File not found: %s\n", fname);
+        return -1;
+    }
+    free(lines);
+    lines = calloc(0x10000, sizeof(uint32_t));
+    free(listfile);
+    listfile = strdup(fname);
+    while (fgets(buf, sizeof(buf), fin)) {
+        /* only look at the start of long lines */
+        if (bol) {
+            n++;
+            /* skip the line number column from --line-numbers */
+            p = buf + strspn(buf, "0123456789");
+            p += strspn(p, " \t");
+            if (*p == '.' || *p == '>') {
+                addr = strtoul(p+1, &q, 16);
+                if (q == p+5 && !lines[addr]) lines[addr] = n;
+            }
+        }
+        bol = strchr(buf, '\n') != NULL;
+    }
+    fclose(fin);
+    return 0;
+}
+
+static void _position(FILE *fout, uint32_t addr) {
+    fprintf(fout, "0x%.4x", addr);
+    if (lines) fprintf(fout, " %u", lines[addr]);
+}
+
+static void _fn(FILE *fout, const char *kind, uint32_t routine, uint8_t *named) {
+    /* callgrind names each function once, then refers to it by number */
+    char buf[8];
+
+    fprintf(fout, "%s=(%u)", kind, routine + 1);
+    if (!named[routine]) fprintf(fout, " %s", _name(routine, buf));
+    fputc('\n', fout);
+    named[routine] = 1;
+}
+
+static void _charge_active(int add) {
+    /* add or remove the inclusive cost so far of active calls */
+    Site *s;
+    uint64_t now[NCOSTS];
+    int i, j;
+
+    _profiled(now);
+    for (i=0; i<nframes; i++) {
+        s = _site(frames[i].caller, frames[i].site, frames[i].routine);
+        for (j=0; j<NCOSTS; j++) {
+            if (add) s->cost[j] += now[j] - frames[i].start[j];
+            else s->cost[j] -= now[j] - frames[i].start[j];
+        }
+    }
+}
+
+static int _cmp_key(const void *p, const void *q) {
+    uint64_t a = ((const Site *)p)->key, b = ((const Site *)q)->key;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+int profile_save_callgrind(const char *fname) {
+    /* write costs by instruction and call site in the callgrind format used by KCachegrind */
+    FILE *fout;
+    Site *sorted, *s;
+    uint64_t total[NCOSTS] = {0};
+    uint32_t i, n = 0, routine, addr, callee, prev = SELF;
+    uint8_t *named;
+    /* samples only charge cycles, so that's the only event */
+    int j, first = sample_every ? 1 : 0, last = sample_every ? 1 : NCOSTS - 1;
+
+    if (!routines) {
+        puts("Profiling is off, see profile on");
+        return -1;
+    }
+    fout = fopen(fname, "w");
+    if (!fout) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        return -1;
+    }
+    if (!sample_every) _charge_active(1);
+    sorted = malloc((nsites ? nsites : 1) * sizeof(Site));
+    for (i=0; i<sitecap; i++) {
+        if (!sites[i].key) continue;
+        sorted[n++] = sites[i];
+        if (((sites[i].key - 1) & 0x1ffff) == SELF)
+            for (j=0; j<NCOSTS; j++) total[j] += sites[i].cost[j];
+    }
+    if (!sample_every) _charge_active(0);
+    qsort(sorted, n, sizeof(Site), _cmp_key);
+
+    fprintf(fout, "# callgrind format\nversion: 1\ncreator: c65 %s\n", SEMANTIC_VERSION);
+    fprintf(fout, "positions: %s\nevents: %s\nsummary:", lines ? "instr line" : "instr",
+        sample_every ? "Cycles" : "Ir Cycles Reads Writes");
+    for (j=first; j<=last; j++) fprintf(fout, " %" PRIu64, total[j]);
+    fprintf(fout, "\n\n");
+    fprintf(fout, "fl=(1) %s\n", listfile ? listfile : "???");
+
+    named = calloc(ROOT + 1, 1);
+    for (i=0; i<n; i++) {
+        s = sorted + i;
+        routine = (s->key - 1) >> 34;
+        addr = ((s->key - 1) >> 17) & 0xffff;
+        callee = (s->key - 1) & 0x1ffff;
+        if (routine != prev) _fn(fout, "fn", routine, named);
+        prev = routine;
+        if (callee != SELF) {
+            _fn(fout, "cfn", callee, named);
+            fprintf(fout, "calls=%" PRIu64 " ", s->calls);
+            _position(fout, callee);
+            fputc('\n', fout);
+        }
+        _position(fout, addr);
+        for (j=first; j<=last; j++) fprintf(fout, " %" PRIu64, s->cost[j]);
+        fputc('\n', fout);
+    }
+    free(named);
+    free(sorted);
+    fclose(fout);
+    if (!quiet) printf("c65: wrote %u cost lines to %s\n", n, fname);
+    return 0;
+}
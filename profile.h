@@ -0,0 +1,25 @@
+/*
+The call profiler follows jsr/rts, brk/rti and interrupts on a shadow stack,
+charging cycles to each routine both inclusive and exclusive of its callees,
+and counting calls along each caller to callee edge.
+It can also write costs by instruction and call site for KCachegrind,
+with source positions from a 64tass listing.  A sampling mode estimates
+the same costs with much less overhead for long runs.
+*/
+
+extern int profile_on;
+
+void profile_enable(int on);
+void profile_sample(uint32_t every);
+void profile_clear();
+
+void profile_step(uint16_t addr, uint32_t dt);
+void profile_call(uint16_t site, uint16_t target, uint8_t sp_before);
+void profile_unwind();
+
+void profile_show(int top);
+void profile_show_calls(int top);
+void profile_show_labels(int top);
+int profile_save(const char *fname);
+int profile_save_callgrind(const char *fname);
+int profile_listing(const char *fname);
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "regions.h"
+#include "c65.h"
+#include "profile.h"
+#include "stats.h"
+
+/*
+Writing an id from 1 to 255 to the region register enters that region,
+and writing 0 leaves the innermost one, so regions nest like calls.
+Each active region remembers the totals when it started and how much its
+nested regions used, so when it ends we can charge it inclusive and
+exclusive costs.  Like the call profiler, inclusive costs are only charged
+when the outermost active entry of an id ends, so recursion isn't counted
+twice.  Counting only happens on entry and exit, so it costs nothing
+while the guest runs.
+
+Writing an id to the profile register selects that region for the call
+profiler, which then only runs while a selected region is active.
+Writing 0 clears the selection and leaves the profiler running or not.
+*/
+
+#define MAX_DEPTH 32
+#define NCOSTS 4            /* cycles, instructions, reads and writes */
+
+typedef struct Region {
+    char *name;
+    uint64_t entries;
+    uint64_t incl[NCOSTS], excl[NCOSTS];
+    uint32_t active;        /* number of active entries */
+    int profile;            /* run the profiler while active? */
+} Region;
+
+typedef struct Level {
+    uint8_t id;
+    uint64_t start[NCOSTS]; /* totals when the region started */
+    uint64_t inner[NCOSTS]; /* inclusive costs of nested regions */
+} Level;
+
+static Region regions[256];
+static Level levels[MAX_DEPTH];
+static int depth = 0, overflow = 0, nprofile = 0;
+
+
+static void _costs(uint64_t *c) {
+    c[0] = ticks;
+    c[1] = instructions;
+    c[2] = bus_reads;
+    c[3] = bus_writes;
+}
+
+static void _gate() {
+    /* with any regions selected, profile only while one of them is active */
+    int i, on = 0;
+
+    if (!nprofile) return;
+    for (i=0; i<depth; i++) on |= regions[levels[i].id].profile;
+    if (on != profile_on) profile_enable(on);
+}
+
+void regions_enter(uint8_t id) {
+    if (depth == MAX_DEPTH) {
+        /* ignore regions nested too deep, along with their exit */
+        overflow++;
+        return;
+    }
+    regions[id].entries++;
+    regions[id].active++;
+    levels[depth].id = id;
+    _costs(levels[depth].start);
+    memset(levels[depth].inner, 0, sizeof(levels[depth].inner));
+    depth++;
+    bus_counting |= BUS_REGIONS;
+    _gate();
+}
+
+void regions_leave() {
+    uint64_t now[NCOSTS], d;
+    Region *r;
+    Level *l;
+    int j;
+
+    if (overflow) {
+        overflow--;
+        return;
+    }
+    if (!depth) return;
+    l = levels + --depth;
+    if (!depth) bus_counting &= ~BUS_REGIONS;
+    r = regions + l->id;
+    _costs(now);
+    r->active--;
+    for (j=0; j<NCOSTS; j++) {
+        d = now[j] - l->start[j];
+        if (!r->active) r->incl[j] += d;
+        r->excl[j] += d - l->inner[j];
+        if (depth) levels[depth-1].inner[j] += d;
+    }
+    _gate();
+}
+
+void regions_profile(uint8_t id) {
+    int i;
+
+    if (id) {
+        nprofile += !regions[id].profile;
+        regions[id].profile = 1;
+    } else {
+        for (i=0; i<256; i++) regions[i].profile = 0;
+        nprofile = 0;
+    }
+    _gate();
+}
+
+void regions_name(uint8_t id, const char *name) {
+    free(regions[id].name);
+    regions[id].name = strdup(name);
+}
+
+void regions_clear() {
+    /* forget the counts but keep names, selections and any active regions */
+    int i, j;
+
+    for (i=0; i<256; i++) {
+        regions[i].entries = 0;
+        memset(regions[i].incl, 0, sizeof(regions[i].incl));
+        memset(regions[i].excl, 0, sizeof(regions[i].excl));
+    }
+    for (i=0; i<depth; i++) {
+        regions[levels[i].id].entries++;
+        _costs(levels[i].start);
+        for (j=0; j<NCOSTS; j++) levels[i].inner[j] = 0;
+    }
+}
+
+
+static void _totals(int id, uint64_t *incl, uint64_t *excl) {
+    /* include the costs so far of active regions */
+    uint64_t now[NCOSTS], d;
+    int i, j, outer = 1;
+
+    _costs(now);
+    memcpy(incl, regions[id].incl, sizeof(regions[id].incl));
+    memcpy(excl, regions[id].excl, sizeof(regions[id].excl));
+    for (i=0; i<depth; i++) {
+        if (levels[i].id != id) continue;
+        for (j=0; j<NCOSTS; j++) {
+            d = now[j] - levels[i].start[j];
+            if (outer) incl[j] += d;
+            /* nested regions which are still active haven't reported yet */
+            excl[j] += d - levels[i].inner[j] - (i+1 < depth ? now[j] - levels[i+1].start[j] : 0);
+        }
+        outer = 0;
+    }
+}
+
+static const char *_name(int id, char *buf) {
+    if (regions[id].name) return regions[id].name;
+    sprintf(buf, "#%d", id);
+    return buf;
+}
+
+void regions_show() {
+    uint64_t incl[NCOSTS], excl[NCOSTS];
+    char buf[8];
+    int i, n = 0;
+
+    for (i=1; i<256; i++) {
+        if (!regions[i].entries) continue;
+        if (!n++) puts(
+            "region            entries       cycles    exclusive  instructions      reads     writes"
+        );
+        _totals(i, incl, excl);
+        printf(
+            "%-16.16s %8" PRIu64 " %12" PRIu64 " %12" PRIu64 " %13" PRIu64 " %10" PRIu64 " %10" PRIu64 "%s\n",
+            _name(i, buf), regions[i].entries, incl[0], excl[0], incl[1], incl[2], incl[3],
+            regions[i].profile ? "  (profiled)" : ""
+        );
+    }
+    if (!n) puts("No regions, see the magic IO region register");
+    if (depth) printf("%d region%s active\n", depth, depth == 1 ? "" : "s");
+}
+
+void regions_json(FILE *f) {
+    /* a list of regions, like [{"id": 1, "name": "compile", "entries": 1, ...}] */
+    uint64_t incl[NCOSTS], excl[NCOSTS];
+    int i, n = 0;
+
+    fputc('[', f);
+    for (i=1; i<256; i++) {
+        if (!regions[i].entries) continue;
+        _totals(i, incl, excl);
+        fprintf(f, "%s\n    {\"id\": %d, ", n++ ? "," : "", i);
+        if (regions[i].name) {
+            fputs("\"name\": ", f);
+            stats_json_str(f, regions[i].name);
+            fputs(", ", f);
+        }
+        fprintf(f,
+            "\"entries\": %" PRIu64 ", \"cycles\": %" PRIu64 ", \"exclusive_cycles\": %" PRIu64
+            ", \"instructions\": %" PRIu64 ", \"reads\": %" PRIu64 ", \"writes\": %" PRIu64 "}",
+            regions[i].entries, incl[0], excl[0], incl[1], incl[2], incl[3]
+        );
+    }
+    fputs(n ? "\n  ]" : "]", f);
+}
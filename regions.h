@@ -0,0 +1,15 @@
+/*
+Guest code can mark regions of interest, like the compile and execute
+phases of a benchmark, through the magic IO region register.  We count
+cycles, instructions and bus traffic for each region id, and can turn on
+the call profiler only while selected regions are active.
+*/
+
+void regions_enter(uint8_t id);
+void regions_leave();
+void regions_profile(uint8_t id);
+void regions_name(uint8_t id, const char *name);
+void regions_clear();
+
+void regions_show();
+void regions_json(FILE *f);
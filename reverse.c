@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define FAKE6502_NOT_STATIC 1
+#define FAKE6502_INCLUDE 1
+#include "fake65c02.h"
+
+#include "reverse.h"
+#include "journal.h"
+#include "c65.h"
+#include "magicio.h"
+#include "monitor.h"
+
+/*
+Checkpoints are taken every `interval` ticks while running, and whenever
+execution resumes from the monitor.  When the ring fills up we drop every
+other checkpoint and double the interval, so history always reaches back
+to where it was enabled, at the cost of a longer replay.
+
+A checkpoint taken after the monitor changed the machine state is pinned,
+since replaying from an earlier checkpoint wouldn't reproduce the change.
+The monitor brackets each command with reverse_mark and reverse_check to
+notice such changes, and then discards any recorded future after that point,
+so output and regions are live again from there.
+
+Replay re-executes instructions without the main loop, so breakpoints and
+BRK don't stop it, and heatmap counts include replayed bus accesses.
+Nothing rolls back the profiler, regions, cycle heat or opstats either,
+so after stepping back they count the replayed instructions again.
+Block and file writes aren't undone on the host, and are skipped on replay.
+*/
+
+typedef struct Checkpoint {
+    unsigned long long instructions;
+    uint64_t ticks, jpos;
+    long mark;
+    IoTimer timers[IO_TIMERS];
+    int io_addr, io_taddr, pinned;
+    uint16_t pc;
+    uint8_t a, x, y, sp, status, waiting6502;
+    uint8_t dirty_pages[0x100];
+    uint8_t memory[0x10000];
+} Checkpoint;
+
+uint64_t reverse_due = UINT64_MAX;
+
+static Checkpoint **cps = NULL;
+static int ncps = 0, maxcps = 0, edited = 0;
+static uint64_t interval = 0, hash = 0;
+
+
+void reverse_enable(uint64_t every, int count) {
+    /* start a fresh history, or turn it off with count 0 */
+    while (ncps) free(cps[--ncps]);
+    free(cps);
+    cps = count ? malloc(count * sizeof(Checkpoint*)) : NULL;
+    maxcps = count;
+    interval = every ? every : 1;
+    edited = 0;
+    journal_clear();
+    if (count) journal_on |= JOURNAL_REVERSE;
+    else journal_on &= ~JOURNAL_REVERSE;
+    reverse_due = count ? ticks : UINT64_MAX;
+    reverse_mark();
+}
+
+static void _thin() {
+    /* keep the first checkpoint, pinned ones and every other one in between */
+    int i, k, skip = 0;
+
+    for (i=k=1; i<ncps; i++) {
+        if (cps[i]->pinned || !(skip = !skip)) cps[k++] = cps[i];
+        else free(cps[i]);
+    }
+    ncps = k;
+    interval *= 2;
+}
+
+void reverse_checkpoint() {
+    Checkpoint *cp;
+
+    if (!maxcps) return;
+    reverse_due = ticks + interval;
+    /* after stepping back, the recorded history already covers this */
+    if (ncps && cps[ncps-1]->instructions >= instructions) return;
+
+    if (ncps == maxcps) _thin();
+    if (ncps == maxcps) {
+        /* everything is pinned, so make room */
+        maxcps *= 2;
+        cps = realloc(cps, maxcps * sizeof(Checkpoint*));
+    }
+    cp = malloc(sizeof(Checkpoint));
+    cp->instructions = instructions;
+    cp->ticks = ticks;
+    cp->jpos = journal_tell();
+    cp->mark = mark;
+    memcpy(cp->timers, io_timers, sizeof(io_timers));
+    cp->io_addr = io_addr;
+    cp->io_taddr = io_taddr;
+    cp->pinned = edited;
+    cp->pc = pc;
+    cp->a = a;
+    cp->x = x;
+    cp->y = y;
+    cp->sp = sp;
+    cp->status = status;
+    cp->waiting6502 = waiting6502;
+    memcpy(cp->dirty_pages, dirty_pages, sizeof(dirty_pages));
+    memcpy(cp->memory, memory, 0x10000);
+    cps[ncps++] = cp;
+    edited = 0;
+}
+
+static void _restore(const Checkpoint *cp) {
+    int i;
+
+    /* output up to here was already seen */
+    if (instructions > io_replay_until) io_replay_until = instructions;
+    instructions = cp->instructions;
+    heat_record_rewind(cp->ticks);
+    ticks = cp->ticks;
+    journal_seek(cp->jpos);
+    mark = cp->mark;
+    memcpy(io_timers, cp->timers, sizeof(io_timers));
+    io_addr = cp->io_addr;
+    io_taddr = cp->io_taddr;
+    pc = cp->pc;
+    a = cp->a;
+    x = cp->x;
+    y = cp->y;
+    sp = cp->sp;
+    status = cp->status;
+    waiting6502 = cp->waiting6502;
+    /*
+    keep pages dirty that are dirty now, since the snapshot base may have
+    changed after the checkpoint, and then its dirty pages are out of date
+    */
+    for (i=0; i<0x100; i++) dirty_pages[i] |= cp->dirty_pages[i];
+    memcpy(memory, cp->memory, 0x10000);
+}
+
+static unsigned long long _replay(unsigned long long target, unsigned long long before) {
+    /*
+    silently execute up to instruction count target, returning the last
+    position before `before` where a forward run would have stopped, or 0
+    */
+    unsigned long long hit = 0;
+
+    while (instructions < target && !waiting6502) {
+        break_flag = 0;
+        ticks += step6502();
+        if (instructions < before
+                && ((breakpoints[pc] & MONITOR_PC) || (break_flag & MONITOR_DATA) || opcode == 0x00))
+            hit = instructions;
+    }
+    break_flag = 0;
+    return hit;
+}
+
+
+static uint64_t _hash() {
+    uint64_t h = 0xcbf29ce484222325;
+    int i;
+
+    for (i=0; i<0x10000; i++) h = (h ^ memory[i]) * 0x100000001b3;  /* FNV-1a */
+    h = (h ^ pc ^ (a << 16) ^ ((uint64_t)x << 24) ^ ((uint64_t)y << 32)
+        ^ ((uint64_t)sp << 40) ^ ((uint64_t)status << 48)) * 0x100000001b3;
+    return (h ^ ticks ^ io_addr) * 0x100000001b3;
+}
+
+void reverse_mark() {
+    if (maxcps) hash = _hash();
+}
+
+void reverse_check() {
+    /* if the monitor changed anything, the recorded future no longer applies */
+    if (!maxcps || _hash() == hash) return;
+    while (ncps && cps[ncps-1]->instructions >= instructions) free(cps[--ncps]);
+    journal_truncate();
+    edited = 1;
+    hash = _hash();
+}
+
+
+int reverse_step(unsigned long long n) {
+    unsigned long long target;
+    int k;
+
+    if (!ncps) {
+        puts("No history, see history on");
+        return -1;
+    }
+    target = n < instructions ? instructions - n : 0;
+    if (target < cps[0]->instructions) {
+        target = cps[0]->instructions;
+        puts("Reached start of history");
+    }
+    for (k=ncps-1; cps[k]->instructions > target; k--) /**/ ;
+    _restore(cps[k]);
+    _replay(target, 0);
+    reverse_mark();
+    return 0;
+}
+
+int reverse_continue() {
+    /* run backwards to the last place a forward run would have stopped */
+    unsigned long long now = instructions, end, hit;
+    int k;
+
+    if (!ncps) {
+        puts("No history, see history on");
+        return -1;
+    }
+    for (k=ncps-1; k>=0; k--) {
+        if (cps[k]->instructions >= now) continue;
+        end = k+1 < ncps && cps[k+1]->instructions < now ? cps[k+1]->instructions : now;
+        _restore(cps[k]);
+        if ((hit = _replay(end, now))) {
+            _restore(cps[k]);
+            _replay(hit, 0);
+            reverse_mark();
+            return 0;
+        }
+    }
+    _restore(cps[0]);
+    reverse_mark();
+    puts("Reached start of history");
+    return 0;
+}
+
+
+void reverse_show() {
+    if (!maxcps) {
+        puts("History is off");
+        return;
+    }
+    printf("History has %d checkpoint%s every %" PRIu64 " ticks", ncps, ncps == 1 ? "" : "s", interval);
+    if (ncps) printf(" back to tick %" PRIu64, cps[0]->ticks);
+    printf(", currently at instruction %llu%s\n", instructions, journal_replaying() ? " (replaying)" : "");
+}
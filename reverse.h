@@ -0,0 +1,17 @@
+/*
+Reverse execution keeps periodic checkpoints of the machine state.
+Stepping backwards restores the nearest earlier checkpoint and replays
+forward to the target, taking magic IO inputs from the journal.
+*/
+
+extern uint64_t reverse_due;    /* ticks when the next checkpoint is due */
+
+void reverse_enable(uint64_t interval, int count);
+void reverse_checkpoint();
+void reverse_show();
+
+void reverse_mark();
+void reverse_check();
+
+int reverse_step(unsigned long long n);
+int reverse_continue();
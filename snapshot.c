@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "snapshot.h"
+#include "c65.h"
+#include "magicio.h"
+#include "parse.h"
+#include "monitor.h"
+
+/*
+Snapshot file format.  All values are little-endian.
+
+    offset  size  description
+    0       4     magic "C65S"
+    4       2     format version (1)
+    6       2     reserved (0)
+
+followed by a sequence of chunks, each with a four character tag,
+a four byte payload length and the payload itself:
+
+    "CPU "  pc (2), a, x, y, sp, status, waiting6502 (1 each), ticks (8),
+            instructions (8), which older snapshots leave out and load as 0
+    "MEM "  the full 64Kb memory image
+    "IO  "  io_addr (2), timer mark (8), block file name (remainder)
+    "TMR "  io_taddr (2), then count (8), start (8) and running (1) for
+            each timer, only with a timer block (optional)
+    "BRK "  the full 64Kb breakpoint map (optional)
+    "LBL "  labels as repeated value (2) and zero-terminated name (optional)
+    "BASE"  id (8) of the base image for an incremental snapshot
+    "PAGE"  repeated page number (1) and 256 byte page, replacing "MEM "
+            in an incremental snapshot
+    "END "  empty, marks the end of the snapshot
+
+Unknown chunks are skipped so the format can grow.
+Open fileio handles aren't captured, since the host files may have moved on.
+
+Saving or loading a full snapshot also makes it the in-memory base image.
+write6502 and host-side writes flag dirty_pages relative to the base,
+so an incremental snapshot only stores the pages changed since then,
+and loading one (or resetting to the base) only copies those pages.
+The base id is a hash of its memory, so we can check that an incremental
+snapshot is applied to the same base it was saved from.
+*/
+
+#define SNAP_MAGIC "C65S"
+#define SNAP_VERSION 1
+
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p+2) << 16); }
+static uint64_t get64(const uint8_t *p) { return get32(p) | ((uint64_t)get32(p+4) << 32); }
+
+static void put16(FILE *f, uint16_t v) { fputc(v & 0xff, f); fputc(v >> 8, f); }
+static void put32(FILE *f, uint32_t v) { put16(f, v & 0xffff); put16(f, v >> 16); }
+static void put64(FILE *f, uint64_t v) { put32(f, v & 0xffffffff); put32(f, v >> 32); }
+
+static void put_chunk(FILE *f, const char *tag, uint32_t len) {
+    fwrite(tag, 4, 1, f);
+    put32(f, len);
+}
+
+
+static struct {
+    int valid;
+    uint64_t id;
+    uint16_t pc;
+    uint8_t a, x, y, sp, status, waiting6502;
+    uint64_t ticks;
+    unsigned long long instructions;
+    int io_addr, io_taddr;
+    long mark;
+    IoTimer timers[IO_TIMERS];
+    uint8_t memory[0x10000];
+} base;
+
+void snapshot_base() {
+    /* make the current state the base for incremental snapshots and reset */
+    uint64_t h = 0xcbf29ce484222325;
+    int i;
+
+    for (i=0; i<0x10000; i++) h = (h ^ memory[i]) * 0x100000001b3;  /* FNV-1a */
+    base.valid = 1;
+    base.id = h;
+    base.pc = pc;
+    base.a = a;
+    base.x = x;
+    base.y = y;
+    base.sp = sp;
+    base.status = status;
+    base.waiting6502 = waiting6502;
+    base.ticks = ticks;
+    base.instructions = instructions;
+    base.io_addr = io_addr;
+    base.io_taddr = io_taddr;
+    base.mark = mark;
+    memcpy(base.timers, io_timers, sizeof(io_timers));
+    memcpy(base.memory, memory, 0x10000);
+    memset(dirty_pages, 0, sizeof(dirty_pages));
+}
+
+static void _restore_pages() {
+    /* copy back just the pages which have changed since the base */
+    int p;
+
+    for (p=0; p<0x100; p++)
+        if (dirty_pages[p]) {
+            memcpy(memory + (p << 8), base.memory + (p << 8), 0x100);
+            dirty_pages[p] = 0;
+        }
+}
+
+int snapshot_reset() {
+    if (!base.valid) {
+        puts("No base snapshot");
+        return -1;
+    }
+    _restore_pages();
+    pc = base.pc;
+    a = base.a;
+    x = base.x;
+    y = base.y;
+    sp = base.sp;
+    status = base.status;
+    waiting6502 = base.waiting6502;
+    heat_record_rewind(base.ticks);
+    ticks = base.ticks;
+    instructions = base.instructions;
+    io_addr = base.io_addr;
+    io_taddr = base.io_taddr;
+    mark = base.mark;
+    memcpy(io_timers, base.timers, sizeof(io_timers));
+    return 0;
+}
+
+
+int snapshot_save(const char *fname, int flags) {
+    FILE *fout;
+    const Symbol *sym, **syms;
+    uint32_t len, n, i;
+    const char *blkname = blkstats.fname ? blkstats.fname : "";
+
+    if ((flags & SNAPSHOT_DELTA) && !base.valid) {
+        puts("No base snapshot for incremental save");
+        return -1;
+    }
+    fout = fopen(fname, "wb");
+    if (!fout) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        return -1;
+    }
+    fwrite(SNAP_MAGIC, 4, 1, fout);
+    put16(fout, SNAP_VERSION);
+    put16(fout, 0);
+
+    put_chunk(fout, "CPU ", 24);
+    put16(fout, pc);
+    fputc(a, fout);
+    fputc(x, fout);
+    fputc(y, fout);
+    fputc(sp, fout);
+    fputc(status, fout);
+    fputc(waiting6502, fout);
+    put64(fout, ticks);
+    put64(fout, instructions);
+
+    if (flags & SNAPSHOT_DELTA) {
+        put_chunk(fout, "BASE", 8);
+        put64(fout, base.id);
+        for (n=i=0; i<0x100; i++) n += dirty_pages[i] ? 1 : 0;
+        put_chunk(fout, "PAGE", n * 257);
+        for (i=0; i<0x100; i++)
+            if (dirty_pages[i]) {
+                fputc(i, fout);
+                fwrite(memory + (i << 8), 1, 0x100, fout);
+            }
+    } else {
+        put_chunk(fout, "MEM ", 0x10000);
+        fwrite(memory, 1, 0x10000, fout);
+    }
+
+    put_chunk(fout, "IO  ", 10 + strlen(blkname));
+    put16(fout, io_addr);
+    put64(fout, (uint64_t)mark);
+    fwrite(blkname, 1, strlen(blkname), fout);
+
+    if (io_taddr >= 0) {
+        put_chunk(fout, "TMR ", 2 + IO_TIMERS * 17);
+        put16(fout, io_taddr);
+        for (i=0; i<IO_TIMERS; i++) {
+            put64(fout, io_timers[i].count);
+            put64(fout, io_timers[i].start);
+            fputc(io_timers[i].running, fout);
+        }
+    }
+
+    if (flags & SNAPSHOT_DEBUG) {
+        put_chunk(fout, "BRK ", 0x10000);
+        fwrite(breakpoints, 1, 0x10000, fout);
+
+        /* write labels oldest first so they reload in the same order */
+        for (n=len=0, sym=get_next_symbol(NULL); sym; sym=get_next_symbol(sym), n++)
+            len += 3 + strlen(sym->name);
+        syms = malloc((n ? n : 1) * sizeof(Symbol*));
+        for (i=n, sym=get_next_symbol(NULL); sym; sym=get_next_symbol(sym))
+            syms[--i] = sym;
+        put_chunk(fout, "LBL ", len);
+        for (i=0; i<n; i++) {
+            put16(fout, syms[i]->value);
+            fwrite(syms[i]->name, 1, strlen(syms[i]->name) + 1, fout);
+        }
+        free(syms);
+    }
+
+    put_chunk(fout, "END ", 0);
+    if (ferror(fout)) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        fclose(fout);
+        return -1;
+    }
+    fclose(fout);
+    if (!(flags & SNAPSHOT_DELTA)) snapshot_base();
+    if (!quiet)
+        printf("c65: wrote %s snapshot to %s\n", flags & SNAPSHOT_DELTA ? "incremental" : "full", fname);
+    return 0;
+}
+
+
+int snapshot_load(const char *fname) {
+    FILE *fin;
+    uint8_t *buf, *p, *end, *cpu = NULL, *mem = NULL, *io = NULL, *tmr = NULL, *brk = NULL, *lbl = NULL;
+    uint8_t *id = NULL, *pages = NULL;
+    uint32_t len, cpulen = 0, iolen = 0, lbllen = 0, npages = 0;
+    long sz;
+    char *blkname;
+    const Symbol *sym;
+    const uint8_t *q;
+
+    fin = fopen(fname, "rb");
+    if (!fin) {
+        fprintf(stderr, "File not found: %s\n", fname);
+        return -1;
+    }
+    fseek(fin, 0L, SEEK_END);
+    sz = ftell(fin);
+    rewind(fin);
+    buf = malloc(sz > 0 ? sz : 1);
+    if (sz < 8 || fread(buf, 1, sz, fin) != sz || memcmp(buf, SNAP_MAGIC, 4) || get16(buf+4) != SNAP_VERSION) {
+        fprintf(stderr, "Not a c65 snapshot: %s\n", fname);
+        free(buf);
+        fclose(fin);
+        return -1;
+    }
+    fclose(fin);
+
+    /* find all the chunks before changing any state */
+    end = buf + sz;
+    for (p = buf + 8; p + 8 <= end; p += 8 + len) {
+        len = get32(p + 4);
+        if (len > end - p - 8) break;
+        if (0 == memcmp(p, "CPU ", 4) && len >= 16) { cpu = p + 8; cpulen = len; }
+        else if (0 == memcmp(p, "MEM ", 4) && len == 0x10000) mem = p + 8;
+        else if (0 == memcmp(p, "IO  ", 4) && len >= 10) { io = p + 8; iolen = len; }
+        else if (0 == memcmp(p, "TMR ", 4) && len >= 2 + IO_TIMERS * 17) tmr = p + 8;
+        else if (0 == memcmp(p, "BRK ", 4) && len == 0x10000) brk = p + 8;
+        else if (0 == memcmp(p, "LBL ", 4)) { lbl = p + 8; lbllen = len; }
+        else if (0 == memcmp(p, "BASE", 4) && len == 8) id = p + 8;
+        else if (0 == memcmp(p, "PAGE", 4) && len % 257 == 0) { pages = p + 8; npages = len / 257; }
+        else if (0 == memcmp(p, "END ", 4)) break;
+    }
+    if (!cpu || !(mem || (id && pages))) {
+        fprintf(stderr, "Incomplete snapshot: %s\n", fname);
+        free(buf);
+        return -1;
+    }
+    if (!mem && (!base.valid || get64(id) != base.id)) {
+        fprintf(stderr, "Incremental snapshot %s doesn't match the current base\n", fname);
+        free(buf);
+        return -1;
+    }
+
+    pc = get16(cpu);
+    a = cpu[2];
+    x = cpu[3];
+    y = cpu[4];
+    sp = cpu[5];
+    status = cpu[6];
+    waiting6502 = cpu[7];
+    heat_record_rewind(get64(cpu + 8));
+    ticks = get64(cpu + 8);
+    instructions = cpulen >= 24 ? get64(cpu + 16) : 0;
+    if (mem) {
+        memcpy(memory, mem, 0x10000);
+    } else {
+        _restore_pages();
+        for (len=0; len<npages; len++) {
+            p = pages + len * 257;
+            memcpy(memory + (p[0] << 8), p + 1, 0x100);
+            dirty_pages[p[0]] = 1;
+        }
+    }
+
+    if (io) {
+        io_addr = get16(io);
+        mark = (long)get64(io + 2);
+        blkname = malloc(iolen - 9);
+        memcpy(blkname, io + 10, iolen - 10);
+        blkname[iolen - 10] = 0;
+        /* keep the current block file (and its stats) if it's unchanged */
+        if (!*blkname) io_blkfile(NULL);
+        else if (!blkstats.fname || strcmp(blkname, blkstats.fname)) io_blkfile(blkname);
+        free(blkname);
+    }
+    /* without a timer chunk keep any --timers block, but start the timers over */
+    memset(io_timers, 0, sizeof(io_timers));
+    if (tmr) {
+        io_taddr = get16(tmr);
+        for (len=0, q=tmr+2; len<IO_TIMERS; len++, q+=17) {
+            io_timers[len].count = get64(q);
+            io_timers[len].start = get64(q + 8);
+            io_timers[len].running = q[16];
+        }
+    }
+    if (brk) memcpy(breakpoints, brk, 0x10000);
+    if (lbl) {
+        while ((sym = get_next_symbol(NULL))) remove_symbol(sym->name);
+        for (q = lbl; q + 3 <= lbl + lbllen && memchr(q + 2, 0, lbl + lbllen - q - 2); q += 3 + strlen((char *)q + 2))
+            add_symbol((char *)q + 2, get16(q));
+    }
+    free(buf);
+    if (mem) snapshot_base();
+
+    if (!quiet) {
+        if (mem) printf("c65: restored snapshot from %s\n", fname);
+        else printf("c65: restored %u page%s from incremental snapshot %s\n", npages, npages == 1 ? "" : "s", fname);
+    }
+    return 0;
+}
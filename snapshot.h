@@ -0,0 +1,13 @@
+/*
+Machine snapshots capture CPU registers, memory, ticks and the magic IO
+binding so a run can resume exactly where it left off.
+*/
+
+#define SNAPSHOT_DEBUG 1    /* also save breakpoints and labels */
+#define SNAPSHOT_DELTA 2    /* only save pages changed since the base */
+
+int snapshot_save(const char *fname, int flags);
+int snapshot_load(const char *fname);
+
+void snapshot_base();
+int snapshot_reset();
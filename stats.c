@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "stats.h"
+#include "c65.h"
+#include "magicio.h"
+#include "parse.h"
+#include "regions.h"
+
+/*
+The stats file is a single JSON object like:
+
+    {
+      "version": "1.2.3",
+      "exit_code": 0,
+      "ticks": 123456,
+      "instructions": 45678,
+      "wall_secs": 0.012345,
+      "mhz": 10.0,
+      "io": {"putc": 10, "getc": 2, "kbhit": 5, "blkio_reads": 0, ...},
+      "breaks": 0,
+      "regions": [{"id": 1, "name": "compile", "entries": 1, "cycles": 1234, ...}, ...],
+      "hot": [{"addr": 65280, "label": "RESET", "count": 99}, ...]
+    }
+
+ticks and instructions are totals, including any restored from a snapshot,
+while wall_secs and mhz only measure the simulation in this process.
+Console IO counts include operations replayed from a journal, while the
+block IO counts cover host reads and writes to every block file in the run.
+*/
+
+extern const char* SEMANTIC_VERSION;     /* from version.h, included by c65.c */
+
+uint64_t stats_breaks = 0;
+
+static uint64_t start_usecs = 0, start_ticks = 0;
+
+
+void stats_start() {
+    start_usecs = _usecs();
+    start_ticks = ticks;
+}
+
+void stats_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int _hottest(uint16_t *hot, int top) {
+    /* fill hot with the most executed addresses, returning how many we found */
+    int i, k, n = 0;
+
+    for (i=0; i<0x10000; i++) {
+        if (!heat_xs[i] || (n == top && heat_xs[i] <= heat_xs[hot[n-1]])) continue;
+        if (n < top) n++;
+        for (k=n-1; k>0 && heat_xs[hot[k-1]] < heat_xs[i]; k--) hot[k] = hot[k-1];
+        hot[k] = i;
+    }
+    return n;
+}
+
+int stats_write(const char *fname, int top) {
+    FILE *f;
+    uint16_t *hot;
+    uint64_t usecs = _usecs() - start_usecs;
+    const Symbol *sym;
+    int i, n;
+
+    f = fopen(fname, "w");
+    if (!f) {
+        fprintf(stderr, "Error writing %s\n", fname);
+        return -1;
+    }
+    fprintf(f, "{\n  \"version\": \"%s\",\n", SEMANTIC_VERSION);
+    fprintf(f, "  \"exit_code\": %d,\n", exit_code);
+    fprintf(f, "  \"ticks\": %" PRIu64 ",\n", ticks);
+    fprintf(f, "  \"instructions\": %llu,\n", instructions);
+    fprintf(f, "  \"wall_secs\": %.6f,\n", usecs / 1e6);
+    fprintf(f, "  \"mhz\": %.3f,\n", usecs ? (double)(ticks - start_ticks) / usecs : 0.0);
+    fprintf(f,
+        "  \"io\": {\"putc\": %" PRIu64 ", \"getc\": %" PRIu64 ", \"kbhit\": %" PRIu64
+        ", \"blkio_reads\": %" PRIu64 ", \"blkio_writes\": %" PRIu64 ", \"blkio_errors\": %" PRIu64 "},\n",
+        iocounts.putc, iocounts.getc, iocounts.kbhit,
+        iocounts.blkreads, iocounts.blkwrites, iocounts.blkerrors
+    );
+    fprintf(f, "  \"breaks\": %" PRIu64 ",\n", stats_breaks);
+    fputs("  \"regions\": ", f);
+    regions_json(f);
+    fputs(",\n", f);
+
+    hot = malloc((top > 0 ? top : 1) * sizeof(uint16_t));
+    n = top > 0 ? _hottest(hot, top) : 0;
+    fputs("  \"hot\": [", f);
+    for (i=0; i<n; i++) {
+        fprintf(f, "%s\n    {\"addr\": %u", i ? "," : "", hot[i]);
+        if ((sym = get_next_symbol_by_value(NULL, hot[i]))) {
+            fputs(", \"label\": ", f);
+            stats_json_str(f, sym->name);
+        }
+        fprintf(f, ", \"count\": %" PRIu64 "}", heat_xs[hot[i]]);
+    }
+    fputs(n ? "\n  ]\n}\n" : "]\n}\n", f);
+    free(hot);
+    fclose(f);
+    return 0;
+}
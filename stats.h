@@ -0,0 +1,10 @@
+/*
+Run statistics are written as JSON on exit with --stats, so that batch jobs
+can track emulator throughput and guest performance without scraping stdout.
+*/
+
+extern uint64_t stats_breaks;      /* times a user breakpoint or BRK stopped execution */
+
+void stats_start();
+int stats_write(const char *fname, int top);
+void stats_json_str(FILE *f, const char *s);
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+/*
+Add up the frames of a heatmap recording, see heat_record in monitor.c,
+and check the totals against full heatmaps saved at the end of the run
+with `heatmap save reads.bin r` and so on:
+
+    heatsum heat.bin reads.bin writes.bin execs.bin
+
+Like the recording, this assumes counts were cleared when it started.
+*/
+
+static const char *_names[] = { "reads", "writes", "executes" };
+static uint64_t sums[3][0x10000];
+
+
+static int _get_varint(FILE *f, uint64_t *v) {
+    int c, shift = 0;
+
+    *v = 0;
+    do {
+        if ((c = fgetc(f)) == EOF || shift > 63) return -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+static int _frame(FILE *f, uint64_t *ticks) {
+    /* add one frame to the sums, returning 1 at the end of the file */
+    uint64_t n, gap, delta;
+    int c, k, addr;
+
+    if ((c = fgetc(f)) == EOF) return 1;
+    ungetc(c, f);
+    if (_get_varint(f, ticks)) return -1;
+    for (k=0; k<3; k++) {
+        if (_get_varint(f, &n)) return -1;
+        for (addr=-1; n--; ) {
+            if (_get_varint(f, &gap) || _get_varint(f, &delta)) return -1;
+            addr += gap + 1;
+            if (addr > 0xffff) return -1;
+            sums[k][addr] += delta;
+        }
+    }
+    return 0;
+}
+
+static int _check(int k, const char *fname) {
+    /* compare one kind of sum with a saved heatmap */
+    uint64_t *saved = malloc(0x10000 * sizeof(uint64_t)), total = 0;
+    FILE *f = fopen(fname, "rb");
+    int addr, err = 0;
+
+    if (!f || fread(saved, sizeof(uint64_t), 0x10000, f) != 0x10000) {
+        fprintf(stderr, "heatsum: can't read a full heatmap from %s\n", fname);
+        err = 1;
+    }
+    for (addr=0; !err && addr<0x10000; addr++) {
+        total += sums[k][addr];
+        if (sums[k][addr] == saved[addr]) continue;
+        printf("%s differ at $%04x: frames %" PRIu64 ", heatmap %" PRIu64 "\n",
+            _names[k], addr, sums[k][addr], saved[addr]);
+        err = 1;
+    }
+    if (!err) printf("%s: %" PRIu64 " in total, matching %s\n", _names[k], total, fname);
+    if (f) fclose(f);
+    free(saved);
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t hdr[8];
+    uint64_t ticks;
+    FILE *f;
+    int k, err = 0, nframes = 0;
+
+    if (argc != 5) {
+        fprintf(stderr, "Usage: heatsum heat.bin reads.bin writes.bin execs.bin\n");
+        return 2;
+    }
+    f = fopen(argv[1], "rb");
+    if (!f || fread(hdr, 1, 8, f) != 8 || memcmp(hdr, "C65H", 4) || (hdr[4] | hdr[5] << 8) != 1) {
+        fprintf(stderr, "heatsum: %s isn't a heatmap recording\n", argv[1]);
+        return 1;
+    }
+    while (!(err = _frame(f, &ticks))) {
+        printf("frame %d ends at tick %" PRIu64 "\n", ++nframes, ticks);
+    }
+    fclose(f);
+    if (err < 0) {
+        fprintf(stderr, "heatsum: %s is truncated after %d frames\n", argv[1], nframes);
+        return 1;
+    }
+    for (err=k=0; k<3; k++) err |= _check(k, argv[2 + k]);
+    return err;
+}